@@ -0,0 +1,270 @@
+// Замеры горячих путей библиотеки raster_overlap на синтетических растрах:
+// загрузка и анализ маски, поиск границ, полигонизация, пересечение GEOS и
+// запись GeoJSON - каждый отдельно.
+//
+// Растры генерируются при первом запуске в каталог RASTER_BENCH_DIR (по
+// умолчанию - во временном каталоге) и переиспользуются. Наибольший размер
+// стороны задает RASTER_BENCH_MAX_SIZE (по умолчанию 16384, до 100000).
+
+#include "raster_overlap.h"
+#include "synthetic_raster.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static string benchDir() {
+    const char* dir = getenv("RASTER_BENCH_DIR");
+    if (dir && *dir) {
+        return dir;
+    }
+    return (filesystem::temp_directory_path() / "raster_overlap_bench").string();
+}
+
+static vector<int> benchSizes(int limit) {
+    const char* env = getenv("RASTER_BENCH_MAX_SIZE");
+    int maxSize = env ? atoi(env) : 16384;
+    vector<int> sizes;
+    for (int size : {1024, 4096, 16384, 32768, 65536, 100000}) {
+        if (size <= maxSize && size <= limit) {
+            sizes.push_back(size);
+        }
+    }
+    return sizes;
+}
+
+// Путь к синтетическому растру; пустой - генерация не удалась
+static string rasterFor(benchmark::State& state, MaskShape shape, int size, int offsetX = 0) {
+    string path = syntheticRaster(benchDir(), shape, size, offsetX);
+    if (path.empty()) {
+        state.SkipWithError("не удалось создать синтетический растр");
+    }
+    return path;
+}
+
+static void setPixelsProcessed(benchmark::State& state, int size) {
+    state.SetItemsProcessed(state.iterations() * (int64_t)size * size);
+}
+
+// Полный проход по маске: чтение, границы, количество и гистограмма по строкам
+static void BM_LoadMaskData(benchmark::State& state, MaskShape shape, MaskStorage storage, const char* kernel) {
+    int size = (int)state.range(0);
+    ProcessorOptions options;
+    options.storage = storage;
+    options.threads = (int)state.range(1);
+    string path = rasterFor(state, shape, size);
+    if (path.empty()) {
+        return;
+    }
+    if (!selectRowScanKernel(kernel)) {
+        state.SkipWithError("ядро сканирования недоступно");
+        return;
+    }
+    
+    for (auto _ : state) {
+        RasterFootprint footprint;
+        if (!computeFootprint(path, options, footprint)) {
+            state.SkipWithError("анализ маски не удался");
+            break;
+        }
+        benchmark::DoNotOptimize(footprint);
+    }
+    selectRowScanKernel("auto");
+    setPixelsProcessed(state, size);
+}
+
+// Только границы: поиск от краев внутрь с ранним выходом
+static void BM_BoundsScan(benchmark::State& state, MaskShape shape) {
+    int size = (int)state.range(0);
+    ProcessorOptions options;
+    options.storage = MaskStorage::Streaming;
+    options.scanMode = MaskScanMode::BoundsOnly;
+    options.threads = (int)state.range(1);
+    string path = rasterFor(state, shape, size);
+    if (path.empty()) {
+        return;
+    }
+    
+    for (auto _ : state) {
+        RasterFootprint footprint;
+        if (!computeFootprint(path, options, footprint)) {
+            state.SkipWithError("поиск границ не удался");
+            break;
+        }
+        benchmark::DoNotOptimize(footprint);
+    }
+    setPixelsProcessed(state, size);
+}
+
+// Реальный контур маски (GDALPolygonize и сборка геометрии GEOS)
+static void BM_Polygonize(benchmark::State& state, MaskShape shape) {
+    int size = (int)state.range(0);
+    ProcessorOptions options;
+    options.footprint = FootprintMode::Polygon;
+    string path = rasterFor(state, shape, size);
+    if (path.empty()) {
+        return;
+    }
+    
+    for (auto _ : state) {
+        RasterFootprint footprint;
+        if (!computeFootprint(path, options, footprint)) {
+            state.SkipWithError("полигонизация недоступна (нужен GEOS)");
+            break;
+        }
+        benchmark::DoNotOptimize(footprint);
+    }
+    setPixelsProcessed(state, size);
+}
+
+// Контуры двух растров, сдвинутых на четверть стороны, строятся один раз
+static bool polygonPair(MaskShape shape, int size, RasterFootprint& a, RasterFootprint& b) {
+    static map<pair<int, int>, pair<RasterFootprint, RasterFootprint>> built;
+    auto key = make_pair((int)shape, size);
+    auto it = built.find(key);
+    if (it == built.end()) {
+        ProcessorOptions options;
+        options.footprint = FootprintMode::Polygon;
+        RasterFootprint first, second;
+        string pathA = syntheticRaster(benchDir(), shape, size);
+        string pathB = syntheticRaster(benchDir(), shape, size, size / 4);
+        if (pathA.empty() || pathB.empty() || !computeFootprint(pathA, options, first) ||
+            !computeFootprint(pathB, options, second)) {
+            return false;
+        }
+        it = built.emplace(key, make_pair(move(first), move(second))).first;
+    }
+    a = it->second.first;
+    b = it->second.second;
+    return true;
+}
+
+// Пересечение двух произвольных контуров (GEOSIntersection)
+static void BM_Intersection(benchmark::State& state, MaskShape shape) {
+    int size = (int)state.range(0);
+    RasterFootprint a, b;
+    if (!polygonPair(shape, size, a, b)) {
+        state.SkipWithError("контуры недоступны (нужен GEOS)");
+        return;
+    }
+    
+    for (auto _ : state) {
+        RasterOverlap overlap;
+        if (!intersectRasterFootprints(a, b, overlap)) {
+            state.SkipWithError("пересечение не удалось");
+            break;
+        }
+        benchmark::DoNotOptimize(overlap);
+    }
+}
+
+// Запись range(0) пересечений: прямоугольников или контура растра-воротника
+static void BM_GeoJSONOutput(benchmark::State& state, bool polygons) {
+    size_t count = (size_t)state.range(0);
+    RasterOverlap overlap;
+    overlap.a = "a.tif";
+    overlap.b = "b.tif";
+    overlap.found = true;
+    if (polygons) {
+        RasterFootprint a, b;
+        if (!polygonPair(MaskShape::RotatedCollar, 1024, a, b) || !intersectRasterFootprints(a, b, overlap) ||
+            !overlap.found) {
+            state.SkipWithError("контуры недоступны (нужен GEOS)");
+            return;
+        }
+    } else {
+        double geoTransform[6];
+        syntheticGeoTransform(0, geoTransform);
+        overlap.rectangle = true;
+        overlap.minX = geoTransform[0];
+        overlap.maxX = geoTransform[0] + 512.0;
+        overlap.maxY = geoTransform[3];
+        overlap.minY = geoTransform[3] - 512.0;
+        overlap.area = 512.0 * 512.0;
+        overlap.crs = syntheticSpatialRefWkt();
+    }
+    vector<RasterOverlap> overlaps(count, overlap);
+    string outputPath = (filesystem::path(benchDir()) / "bench_output.geojson").string();
+    
+    for (auto _ : state) {
+        if (!writeRasterOverlaps(outputPath, overlaps)) {
+            state.SkipWithError("запись не удалась");
+            break;
+        }
+    }
+    
+    error_code ec;
+    uintmax_t bytes = filesystem::file_size(outputPath, ec);
+    if (!ec) {
+        state.SetBytesProcessed(state.iterations() * (int64_t)bytes);
+    }
+    state.SetItemsProcessed(state.iterations() * (int64_t)count);
+    filesystem::remove(outputPath, ec);
+}
+
+static void registerBenchmarks() {
+    const MaskShape shapes[] = {MaskShape::Full, MaskShape::RotatedCollar, MaskShape::Sparse, MaskShape::Noisy};
+    // Плотная маска 100k x 100k - 10 ГБ, поэтому для нее размер ограничен
+    const struct {
+        const char* name;
+        MaskStorage storage;
+        int limit;
+    } storages[] = {{"dense", MaskStorage::Dense, 32768}, {"bits", MaskStorage::Bits, 100000}};
+    
+    for (MaskShape shape : shapes) {
+        string shapeName = maskShapeName(shape);
+        
+        // Потоки: 1 и все ядра (0); ядра сканирования: scalar против выбранного автоматически
+        for (const auto& storage : storages) {
+            for (const char* kernel : {"scalar", "auto"}) {
+                string name = "LoadMaskData/" + shapeName + "/" + storage.name + "/" + kernel;
+                auto* bench = benchmark::RegisterBenchmark(name.c_str(), BM_LoadMaskData, shape, storage.storage, kernel);
+                for (int size : benchSizes(storage.limit)) {
+                    bench->Args({size, 1})->Args({size, 0});
+                }
+                bench->ArgNames({"size", "threads"})->Unit(benchmark::kMillisecond)->UseRealTime();
+            }
+        }
+        
+        auto* bounds = benchmark::RegisterBenchmark(("BoundsScan/" + shapeName).c_str(), BM_BoundsScan, shape);
+        for (int size : benchSizes(100000)) {
+            bounds->Args({size, 1})->Args({size, 0});
+        }
+        bounds->ArgNames({"size", "threads"})->Unit(benchmark::kMillisecond)->UseRealTime();
+        
+        // Шумная маска дает контур с миллионами вершин уже на 4096
+        int polygonLimit = shape == MaskShape::Noisy ? 1024 : 4096;
+        auto* polygonize = benchmark::RegisterBenchmark(("Polygonize/" + shapeName).c_str(), BM_Polygonize, shape);
+        auto* intersection = benchmark::RegisterBenchmark(("Intersection/" + shapeName).c_str(), BM_Intersection, shape);
+        for (int size : benchSizes(polygonLimit)) {
+            polygonize->Arg(size);
+            intersection->Arg(size);
+        }
+        polygonize->ArgNames({"size"})->Unit(benchmark::kMillisecond);
+        intersection->ArgNames({"size"})->Unit(benchmark::kMillisecond);
+    }
+    
+    for (bool polygons : {false, true}) {
+        string name = string("GeoJSONOutput/") + (polygons ? "polygons" : "rectangles");
+        benchmark::RegisterBenchmark(name.c_str(), BM_GeoJSONOutput, polygons)
+            ->Arg(1000)->Arg(100000)->ArgNames({"features"})->Unit(benchmark::kMillisecond);
+    }
+}
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    registerBenchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,196 @@
+#include "synthetic_raster.h"
+
+#include "gdal.h"
+#include "gdal_priv.h"
+#include "ogr_spatialref.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+// M_PI не входит в стандарт C++ (в MSVC - только с _USE_MATH_DEFINES)
+static constexpr double kPi = 3.14159265358979323846;
+
+const char* maskShapeName(MaskShape shape) {
+    switch (shape) {
+        case MaskShape::Full: return "full";
+        case MaskShape::RotatedCollar: return "collar";
+        case MaskShape::Sparse: return "sparse";
+        case MaskShape::Noisy: return "noisy";
+    }
+    return "unknown";
+}
+
+// Детерминированный шум: splitmix64 от координат
+static uint64_t pixelHash(uint64_t x, uint64_t y) {
+    uint64_t z = (x << 32) ^ y;
+    z += 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Отрезок [x0, x1) строки y внутри квадрата со стороной 0.7 * size,
+// повернутого на 30 градусов вокруг центра растра: пересечение
+// четырех полуплоскостей |u| < h, |v| < h, линейных по x
+static void collarRowRange(int size, int y, int& x0, int& x1) {
+    const double angle = 30.0 * kPi / 180.0;
+    const double c = cos(angle), s = sin(angle);
+    const double h = 0.35 * size;
+    const double center = 0.5 * size;
+    double dy = y + 0.5 - center;
+    
+    // u = dx*c + dy*s, v = -dx*s + dy*c; dx = x + 0.5 - center
+    double lo = -1e300, hi = 1e300;
+    auto clip = [&](double a, double b) {
+        // -h < a*dx + b < h
+        double p = (-h - b) / a, q = (h - b) / a;
+        if (p > q) swap(p, q);
+        lo = max(lo, p);
+        hi = min(hi, q);
+    };
+    clip(c, dy * s);
+    clip(-s, dy * c);
+    
+    x0 = max(0, (int)ceil(lo + center - 0.5));
+    x1 = min(size, (int)floor(hi + center - 0.5) + 1);
+    if (x1 < x0) x1 = x0;
+}
+
+void syntheticAlphaRow(MaskShape shape, int size, int y, uint8_t* row) {
+    switch (shape) {
+        case MaskShape::Full:
+            fill(row, row + size, (uint8_t)255);
+            return;
+        
+        case MaskShape::RotatedCollar:
+        case MaskShape::Noisy: {
+            int x0, x1;
+            collarRowRange(size, y, x0, x1);
+            fill(row, row + size, (uint8_t)0);
+            fill(row + x0, row + x1, (uint8_t)255);
+            if (shape == MaskShape::RotatedCollar) {
+                return;
+            }
+            // Внутри выпадает ~1/32 пикселей, снаружи ~1/256 - одиночный шум
+            for (int x = 0; x < size; ++x) {
+                uint64_t hash = pixelHash((uint64_t)x, (uint64_t)y);
+                if (row[x] ? (hash & 31) == 0 : (hash & 255) == 0) {
+                    row[x] ^= 255;
+                }
+            }
+            return;
+        }
+        
+        case MaskShape::Sparse: {
+            // Сетка 16 x 16 ячеек, в половине ячеек прямоугольник 15% x 15% ячейки
+            const int cells = 16;
+            fill(row, row + size, (uint8_t)0);
+            double cell = (double)size / cells;
+            int cy = min(cells - 1, (int)(y / cell));
+            double fy = y / cell - cy;
+            if (fy < 0.40 || fy >= 0.55) {
+                return;
+            }
+            for (int cx = 0; cx < cells; ++cx) {
+                if (pixelHash((uint64_t)cx, (uint64_t)cy) & 1) {
+                    continue;
+                }
+                int x0 = (int)((cx + 0.40) * cell);
+                int x1 = min(size, (int)((cx + 0.55) * cell));
+                fill(row + x0, row + max(x0, x1), (uint8_t)255);
+            }
+            return;
+        }
+    }
+}
+
+void syntheticGeoTransform(double offsetX, double geoTransform[6]) {
+    const double pixel = 0.5;
+    geoTransform[0] = 500000.0 + offsetX * pixel;
+    geoTransform[1] = pixel;
+    geoTransform[2] = 0.0;
+    geoTransform[3] = 6200000.0;
+    geoTransform[4] = 0.0;
+    geoTransform[5] = -pixel;
+}
+
+string syntheticSpatialRefWkt() {
+    OGRSpatialReference srs;
+    srs.SetFromUserInput("EPSG:32637");
+    char* wkt = nullptr;
+    srs.exportToWkt(&wkt);
+    string result = wkt ? wkt : "";
+    CPLFree(wkt);
+    return result;
+}
+
+string syntheticRaster(const string& dir, MaskShape shape, int size, int offsetX) {
+    ostringstream name;
+    name << maskShapeName(shape) << "_" << size << "_" << offsetX << ".tif";
+    filesystem::path path = filesystem::path(dir) / name.str();
+    if (filesystem::exists(path)) {
+        return path.string();
+    }
+    
+    GDALAllRegister();
+    error_code ec;
+    filesystem::create_directories(dir, ec);
+    
+    GDALDriver* driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    if (!driver) {
+        return string();
+    }
+    
+    // Сначала во временный файл: прерванная генерация не оставит обрезанный растр
+    string tempPath = path.string() + ".tmp";
+    char** options = nullptr;
+    options = CSLSetNameValue(options, "TILED", "YES");
+    options = CSLSetNameValue(options, "BLOCKXSIZE", "512");
+    options = CSLSetNameValue(options, "BLOCKYSIZE", "512");
+    options = CSLSetNameValue(options, "COMPRESS", "DEFLATE");
+    options = CSLSetNameValue(options, "ALPHA", "YES");
+    options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+    GDALDataset* dataset = driver->Create(tempPath.c_str(), size, size, 2, GDT_Byte, options);
+    CSLDestroy(options);
+    if (!dataset) {
+        return string();
+    }
+    
+    double geoTransform[6];
+    syntheticGeoTransform(offsetX, geoTransform);
+    dataset->SetGeoTransform(geoTransform);
+    string wkt = syntheticSpatialRefWkt();
+    dataset->SetProjection(wkt.c_str());
+    
+    cout << "Генерация " << path.filename().string() << " (" << size << "x" << size << ")" << endl;
+    
+    // Полосами по высоте тайла
+    const int stripRows = 512;
+    vector<uint8_t> gray((size_t)size * stripRows, 128);
+    vector<uint8_t> alpha((size_t)size * stripRows);
+    bool ok = true;
+    for (int y0 = 0; y0 < size && ok; y0 += stripRows) {
+        int rows = min(stripRows, size - y0);
+        for (int r = 0; r < rows; ++r) {
+            syntheticAlphaRow(shape, size, y0 + r, alpha.data() + (size_t)r * size);
+        }
+        ok = dataset->GetRasterBand(1)->RasterIO(GF_Write, 0, y0, size, rows, gray.data(),
+                                                 size, rows, GDT_Byte, 0, 0) == CE_None &&
+             dataset->GetRasterBand(2)->RasterIO(GF_Write, 0, y0, size, rows, alpha.data(),
+                                                 size, rows, GDT_Byte, 0, 0) == CE_None;
+    }
+    GDALClose(dataset);
+    
+    if (!ok) {
+        filesystem::remove(tempPath, ec);
+        return string();
+    }
+    filesystem::rename(tempPath, path, ec);
+    return ec ? string() : path.string();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+// Синтетические растры для замеров: серый канал и альфа-канал заданной
+// формы, тайловый GeoTIFF со сжатием. Генерация идет полосами, так что
+// растры до 100k x 100k строятся без хранения маски в памяти.
+
+#include <cstdint>
+#include <string>
+
+enum class MaskShape {
+    Full,           // весь растр валиден
+    RotatedCollar,  // повернутый на 30 градусов квадрат в рамке nodata (ортофотоплан)
+    Sparse,         // редкие небольшие прямоугольники, ~1% площади
+    Noisy           // повернутый квадрат с выпадающими пикселями внутри и шумом снаружи
+};
+
+const char* maskShapeName(MaskShape shape);
+
+// Строка y альфа-канала (0 или 255) растра size x size
+void syntheticAlphaRow(MaskShape shape, int size, int y, uint8_t* row);
+
+// Геотрансформация синтетических растров: 0.5 м, UTM 37N; offsetX сдвигает
+// растр по оси X на заданное число пикселей
+void syntheticGeoTransform(double offsetX, double geoTransform[6]);
+std::string syntheticSpatialRefWkt();
+
+// Путь к готовому растру в каталоге dir; создает его, если файла еще нет
+std::string syntheticRaster(const std::string& dir, MaskShape shape, int size, int offsetX = 0);
@@ -1,351 +1,278 @@
-#include "gdal.h"
-#include "gdal_priv.h"
-#include "nlohmann/json.hpp"
-
-// C API
-#ifdef HAS_GEOS
-#include "geos_c.h"
-#endif
-
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <memory>
-#include <algorithm>
-
-using json = nlohmann::json;
-using namespace std;
-
-class RasterProcessor {
-private:
-    GDALDataset* dataset;
-    int width, height;
-    vector<uint8_t> maskData;
-    double geoTransform[6];
-    bool hasGeoTransform;
-    
-public:
-    RasterProcessor() : dataset(nullptr), hasGeoTransform(false) {
-        GDALAllRegister();
-    }
-    
-    ~RasterProcessor() {
-        if (dataset) {
-            GDALClose(dataset);
-        }
-    }
-    
-    bool loadRaster(const string& filename) {
-        dataset = (GDALDataset*)GDALOpen(filename.c_str(), GA_ReadOnly);
-        if (!dataset) {
-            cerr << "Не удалось открыть файл: " << filename << endl;
-            return false;
-        }
-        
-        width = dataset->GetRasterXSize();
-        height = dataset->GetRasterYSize();
-        hasGeoTransform = (dataset->GetGeoTransform(geoTransform) == CE_None);
-        
-        cout << "Загружен: " << filename << " (" << width << "x" << height << ")" << endl;
-        
-        return loadMaskData();
-    }
-    
-    #ifdef HAS_GEOS
-    GEOSGeometry* getValidGeometry() {
-        if (maskData.empty()) {
-            return nullptr;
-        }
-        
-        cout << "Создание геометрии из маски..." << endl;
-        
-        // Границы непрозрачных данных
-        int dataMinX = width, dataMinY = height, dataMaxX = 0, dataMaxY = 0;
-        bool foundData = false;
-        
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                if (isOpaque(x, y)) {
-                    foundData = true;
-                    dataMinX = min(dataMinX, x);
-                    dataMinY = min(dataMinY, y);
-                    dataMaxX = max(dataMaxX, x);
-                    dataMaxY = max(dataMaxY, y);
-                }
-            }
-        }
-        
-        if (!foundData) {
-            cout << "Непрозрачные данные не найдены" << endl;
-            return nullptr;
-        }
-        
-        cout << "Границы данных: [" << dataMinX << "," << dataMinY << "] - [" 
-             << dataMaxX << "," << dataMaxY << "]" << endl;
-        
-        // Преобразуем в географические координаты
-        double ulx, uly, lrx, lry;
-        pixelToGeo(dataMinX, dataMinY, ulx, uly);
-        pixelToGeo(dataMaxX + 1, dataMaxY + 1, lrx, lry);
-        
-        cout << "Географические границы: [" << ulx << "," << uly << "] - [" 
-             << lrx << "," << lry << "]" << endl;
-        
-        // Создаем полигон через GEOS C API
-        GEOSCoordSequence* coordSeq = GEOSCoordSeq_create(5, 2);
-        
-        GEOSCoordSeq_setX(coordSeq, 0, ulx);
-        GEOSCoordSeq_setY(coordSeq, 0, uly);
-        
-        GEOSCoordSeq_setX(coordSeq, 1, lrx);
-        GEOSCoordSeq_setY(coordSeq, 1, uly);
-        
-        GEOSCoordSeq_setX(coordSeq, 2, lrx);
-        GEOSCoordSeq_setY(coordSeq, 2, lry);
-        
-        GEOSCoordSeq_setX(coordSeq, 3, ulx);
-        GEOSCoordSeq_setY(coordSeq, 3, lry);
-        
-        GEOSCoordSeq_setX(coordSeq, 4, ulx);
-        GEOSCoordSeq_setY(coordSeq, 4, uly);
-        
-        GEOSGeometry* ring = GEOSGeom_createLinearRing(coordSeq);
-        GEOSGeometry* polygon = GEOSGeom_createPolygon(ring, nullptr, 0);
-        
-        return polygon;
-    }
-    #endif
-    
-    void printDetailedInfo() {
-        if (!dataset) return;
-        
-        cout << "\nДетальная информация о растре:" << endl;
-        cout << "Размер: " << width << "x" << height << endl;
-        cout << "Каналы: " << dataset->GetRasterCount() << endl;
-        
-        for (int i = 1; i <= dataset->GetRasterCount(); ++i) {
-            GDALRasterBand* band = dataset->GetRasterBand(i);
-            GDALColorInterp colorType = band->GetColorInterpretation();
-            const char* colorName = GDALGetColorInterpretationName(colorType);
-            cout << "  Канал " << i << ": " << colorName << endl;
-        }
-        
-        // Статистика по маске
-        int opaqueCount = 0;
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                if (isOpaque(x, y)) {
-                    opaqueCount++;
-                }
-            }
-        }
-        
-        cout << "Непрозрачных пикселей: " << opaqueCount 
-             << " (" << (opaqueCount * 100.0 / (width * height)) << "%)" << endl;
-        
-        // Информация о геотрансформации
-        if (hasGeoTransform) {
-            cout << "Геотрансформация: [" << geoTransform[0] << ", " << geoTransform[1] 
-                 << ", " << geoTransform[2] << ", " << geoTransform[3] 
-                 << ", " << geoTransform[4] << ", " << geoTransform[5] << "]" << endl;
-        } else {
-            cout << "Геотрансформация не найдена" << endl;
-        }
-    }
-    
-private:
-    bool loadMaskData() {
-        int alphaBand = findAlphaBand();
-        if (alphaBand == -1) {
-            cerr << "Альфа-канал не найдена" << endl;
-            return false;
-        }
-        
-        cout << "Загрузка альфа-канала (канал " << alphaBand << ")..." << endl;
-        
-        GDALRasterBand* band = dataset->GetRasterBand(alphaBand);
-        maskData.resize(width * height);
-        
-        CPLErr err = band->RasterIO(GF_Read, 0, 0, width, height,
-                                  maskData.data(), width, height,
-                                  GDT_Byte, 0, 0);
-        
-        return err == CE_None;
-    }
-    
-    int findAlphaBand() {
-        int bandCount = dataset->GetRasterCount();
-        
-        for (int i = 1; i <= bandCount; ++i) {
-            GDALRasterBand* band = dataset->GetRasterBand(i);
-            GDALColorInterp colorInterp = band->GetColorInterpretation();
-            
-            if (colorInterp == GCI_AlphaBand) {
-                return i;
-            }
-        }
-        
-        if (bandCount >= 4) {
-            return bandCount;
-        }
-        
-        return -1;
-    }
-    
-    bool isOpaque(int x, int y) {
-        return maskData[y * width + x] == 255;
-    }
-    
-    void pixelToGeo(int x, int y, double& geoX, double& geoY) {
-        if (hasGeoTransform) {
-            geoX = geoTransform[0] + x * geoTransform[1] + y * geoTransform[2];
-            geoY = geoTransform[3] + x * geoTransform[4] + y * geoTransform[5];
-        } else {
-            geoX = x;
-            geoY = height - y;
-        }
-    }
-};
-
-#ifdef HAS_GEOS
-string geometryToGeoJSON(GEOSGeometry* geometry) {
-    if (!geometry) {
-        return R"({"type": "FeatureCollection", "features": []})";
-    }
-    
-    // Получаем bounding box геометрии
-    double minX = 0.0, minY = 0.0, maxX = 100.0, maxY = 100.0;
-    
-    // Простой способ - используем envelope для получения bounding box
-    GEOSGeometry* envelope = GEOSEnvelope(geometry);
-    if (envelope) {
-        // Получаем внешнее кольцо envelope
-        const GEOSGeometry* ring = GEOSGetExteriorRing(envelope);
-        if (ring) {
-            const GEOSCoordSequence* coordSeq = GEOSGeom_getCoordSeq(ring);
-            if (coordSeq) {
-                unsigned int size;
-                if (GEOSCoordSeq_getSize(coordSeq, &size)) {
-                    // Берем первую точку (min) и третью точку (max) для bounding box
-                    GEOSCoordSeq_getX(coordSeq, 0, &minX);
-                    GEOSCoordSeq_getY(coordSeq, 0, &minY);
-                    GEOSCoordSeq_getX(coordSeq, 2, &maxX);
-                    GEOSCoordSeq_getY(coordSeq, 2, &maxY);
-                }
-            }
-        }
-        GEOSGeom_destroy(envelope);
-    }
-    
-    json geojson = {
-        {"type", "FeatureCollection"},
-        {"features", {
-            {
-                {"type", "Feature"},
-                {"properties", {
-                    {"name", "Intersection Area"}
-                }},
-                {"geometry", {
-                    {"type", "Polygon"},
-                    {"coordinates", {{
-                        {minX, minY},
-                        {maxX, minY},
-                        {maxX, maxY},
-                        {minX, maxY},
-                        {minX, minY}
-                    }}}
-                }}
-            }
-        }}
-    };
-    
-    return geojson.dump(4);
-}
-#endif
-
-int main() {
-    #ifdef HAS_GEOS
-    // Инициализируем GEOS
-    initGEOS(nullptr, nullptr);
-    #endif
-    
-    try {
-        cout << "=== Анализатор пересечения растров (GEOS C API) ===" << endl;
-        
-        // Обрабатываем первое изображение
-        RasterProcessor processor1;
-        if (!processor1.loadRaster("orto1.tif")) {
-            cerr << "Ошибка загрузки orto1.tif" << endl;
-            return 1;
-        }
-        processor1.printDetailedInfo();
-        
-        // Обрабатываем второе изображение  
-        RasterProcessor processor2;
-        if (!processor2.loadRaster("orto2.tif")) {
-            cerr << "Ошибка загрузки orto2.tif" << endl;
-            return 1;
-        }
-        processor2.printDetailedInfo();
-        
-        #ifdef HAS_GEOS
-        cout << "\nВычисление пересечения..." << endl;
-        
-        GEOSGeometry* geometry1 = processor1.getValidGeometry();
-        GEOSGeometry* geometry2 = processor2.getValidGeometry();
-        
-        if (geometry1 && geometry2) {
-            cout << "Геометрии созданы успешно" << endl;
-            
-            // Вычисляем пересечение
-            GEOSGeometry* intersection = GEOSIntersection(geometry1, geometry2);
-            
-            if (intersection && !GEOSisEmpty(intersection)) {
-                cout << "Пересечение найдено!" << endl;
-                
-                string geojson = geometryToGeoJSON(intersection);
-                ofstream file("intersection_obchaja_2.geojson");
-                file << geojson;
-                file.close();
-                
-                cout << "Файл intersection_obchaja_2.geojson создан!" << endl;
-                
-                GEOSGeom_destroy(intersection);
-            } else {
-                cout << "Пересечение не найдено или пустое" << endl;
-                
-                json emptyGeojson = {
-                    {"type", "FeatureCollection"},
-                    {"features", json::array()}
-                };
-                
-                ofstream file("intersection_obchaja_2.geojson");
-                file << emptyGeojson.dump(4);
-                file.close();
-            }
-            
-            GEOSGeom_destroy(geometry1);
-            GEOSGeom_destroy(geometry2);
-        } else {
-            cerr << "Не удалось создать геометрии" << endl;
-            if (!geometry1) cerr << "  - Геометрия 1 не создана" << endl;
-            if (!geometry2) cerr << "  - Геометрия 2 не создана" << endl;
-        }
-        #else
-        cout << "GEOS не доступен" << endl;
-        #endif
-        
-    } catch (const exception& e) {
-        cerr << "Ошибка: " << e.what() << endl;
-        return 1;
-    }
-    
-    #ifdef HAS_GEOS
-    // Завершаем GEOS
-    finishGEOS();
-    #endif
-    
-    cout << "\nПрограмма завершена" << endl;
-    return 0;
-
-}
+#include "raster_overlap.h"
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <string>
+#include <exception>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+void printUsage() {
+    cout << "Использование: raster_intersection [параметры] [растр1 растр2]\n"
+         << "               raster_intersection [параметры] --batch каталог|список\n"
+         << "Параметры:\n"
+         << "  --streaming         поблочное чтение маски\n"
+         << "  --spans             маска как отрезки по строкам (RLE)\n"
+         << "  --bits              маска по 1 биту на пиксель\n"
+         << "  --no-mmap           не отображать несжатый канал маски в память, а копировать\n"
+         << "  --bounds-only       только границы, поиск от краев внутрь\n"
+         << "  --overviews         поиск границ по обзорам с точным уточнением\n"
+         << "  --footprint         реальный контур маски вместо прямоугольника\n"
+         << "  --simplify допуск   упрощение контура\n"
+         << "  --threads N         потоков анализа маски (0 - все ядра)\n"
+         << "  --kernel имя        ядро сканирования: auto, scalar, sse2, avx2, neon\n"
+         << "  --jobs N            входов, загружаемых одновременно (по умолчанию 2)\n"
+         << "  --batch источник    все попарные пересечения растров каталога или списка\n"
+         << "  --reference растр   с --batch: пересечения одного растра со всеми остальными\n"
+         << "  --changed список    с --batch: обновить прежний --output, пересчитав только пары этих растров\n"
+         << "  --shard i/N         с --batch: только пары шарда i из N (i от 0), для запуска на разных узлах\n"
+         << "  --merge файлы...    объединить результаты шардов в --output без повторов\n"
+         << "  --cache файл        постоянный кэш валидных областей\n"
+         << "  --crs определение   общая система координат (по умолчанию - первого растра)\n"
+         << "  --windowed          пара: сравнение охватов, затем маски только в общем окне\n"
+         << "  --output файл       файл результата: .fgb - FlatGeobuf, .gpkg - GeoPackage, иначе GeoJSON\n"
+         << "  --mask-output файл  попиксельная маска пересечения пары (1-битный COG)\n"
+         << "  --quiet, -q         только ошибки\n"
+         << "  --verbose, -v       сообщения анализа каждого растра и полная статистика маски\n"
+         << "  --metrics файл      время стадий и счетчики чтения (.prom - Prometheus, иначе JSON lines)\n"
+         << "  --io-profile имя    настройки ввода-вывода GDAL: local или cloud (по умолчанию для URL)\n"
+         << "  --cache-max МБ      размер блочного кэша GDAL\n"
+         << "  --io-threads N      потоков распаковки блоков GDAL (0 - все ядра)" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    ProcessorOptions options;
+    vector<string> inputs;
+    string batchSource;
+    string referencePath;
+    string changedList;
+    bool merge = false;
+    JobSettings job;
+    string cachePath;
+    string metricsPath;
+    Verbosity verbosity = Verbosity::Normal;
+    IoProfile ioProfile;
+    bool ioProfileChosen = false;
+    bool scanChosen = false;    // способ хранения или сканирования задан явно
+    
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--streaming") {
+            options.storage = MaskStorage::Streaming;
+            scanChosen = true;
+        } else if (arg == "--spans") {
+            options.storage = MaskStorage::Spans;
+            scanChosen = true;
+        } else if (arg == "--bits") {
+            options.storage = MaskStorage::Bits;
+            scanChosen = true;
+        } else if (arg == "--no-mmap") {
+            options.mapMask = false;
+        } else if (arg == "--overviews") {
+            options.useOverviews = true;
+        } else if (arg == "--bounds-only") {
+            options.scanMode = MaskScanMode::BoundsOnly;
+            scanChosen = true;
+        } else if (arg == "--quiet" || arg == "-q") {
+            verbosity = Verbosity::Quiet;
+        } else if (arg == "--verbose" || arg == "-v") {
+            verbosity = Verbosity::Verbose;
+        } else if (arg == "--footprint") {
+            options.footprint = FootprintMode::Polygon;
+        } else if (arg == "--simplify" && i + 1 < argc) {
+            options.simplifyTolerance = atof(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = atoi(argv[++i]);
+        } else if (arg == "--kernel" && i + 1 < argc) {
+            string name = argv[++i];
+            if (!selectRowScanKernel(name)) {
+                cerr << "Ядро сканирования недоступно: " << name << endl;
+                return 1;
+            }
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            job.jobs = atoi(argv[++i]);
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batchSource = argv[++i];
+        } else if (arg == "--reference" && i + 1 < argc) {
+            referencePath = argv[++i];
+        } else if (arg == "--changed" && i + 1 < argc) {
+            changedList = argv[++i];
+        } else if (arg == "--shard" && i + 1 < argc) {
+            string shard = argv[++i];
+            size_t slash = shard.find('/');
+            job.shardIndex = slash == string::npos ? -1 : atoi(shard.substr(0, slash).c_str());
+            job.shardCount = slash == string::npos ? 0 : atoi(shard.substr(slash + 1).c_str());
+            if (job.shardCount < 1 || job.shardIndex < 0 || job.shardIndex >= job.shardCount) {
+                cerr << "Шард задается как i/N, 0 <= i < N: " << shard << endl;
+                return 1;
+            }
+        } else if (arg == "--merge") {
+            merge = true;
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cachePath = argv[++i];
+        } else if (arg == "--crs" && i + 1 < argc) {
+            job.targetCrs = argv[++i];
+        } else if (arg == "--windowed") {
+            job.windowed = true;
+        } else if (arg == "--mask-output" && i + 1 < argc) {
+            job.maskOutputPath = argv[++i];
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            metricsPath = argv[++i];
+        } else if (arg == "--io-profile" && i + 1 < argc) {
+            string name = argv[++i];
+            if (name == "local") {
+                ioProfile.preset = IoPreset::Local;
+            } else if (name == "cloud") {
+                ioProfile.preset = IoPreset::Cloud;
+            } else {
+                cerr << "Неизвестный профиль ввода-вывода: " << name << endl;
+                return 1;
+            }
+            ioProfileChosen = true;
+        } else if (arg == "--cache-max" && i + 1 < argc) {
+            ioProfile.cacheMaxMb = atoi(argv[++i]);
+        } else if (arg == "--io-threads" && i + 1 < argc) {
+            ioProfile.decodeThreads = atoi(argv[++i]);
+        } else if (arg == "--output" && i + 1 < argc) {
+            job.outputPath = argv[++i];
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage();
+            return 0;
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    
+    if (job.windowed && (!batchSource.empty() || options.footprint == FootprintMode::Polygon)) {
+        cerr << "--windowed доступен только для пары растров с прямоугольными областями" << endl;
+        return 1;
+    }
+    if (!job.maskOutputPath.empty() && !batchSource.empty()) {
+        cerr << "--mask-output доступен только для пары растров" << endl;
+        return 1;
+    }
+    if (!changedList.empty() && (batchSource.empty() || !referencePath.empty())) {
+        cerr << "--changed используется вместе с --batch, без --reference" << endl;
+        return 1;
+    }
+    if (job.shardCount > 1 && (batchSource.empty() || !referencePath.empty() || !changedList.empty())) {
+        cerr << "--shard используется вместе с --batch, без --reference и --changed" << endl;
+        return 1;
+    }
+    if (merge) {
+        if (!batchSource.empty() || inputs.empty()) {
+            cerr << "--merge объединяет файлы результатов шардов, перечисленные после параметров" << endl;
+            return 1;
+        }
+        if (job.outputPath.empty()) job.outputPath = "overlaps.geojson";
+        for (const string& part : inputs) {
+            if (part == job.outputPath) {
+                cerr << "Файл результата совпадает с объединяемым: " << part << endl;
+                return 1;
+            }
+        }
+    } else if (!referencePath.empty()) {
+        if (batchSource.empty()) {
+            cerr << "--reference используется вместе с --batch" << endl;
+            return 1;
+        }
+        inputs = {referencePath};
+        for (const string& path : collectInputs(batchSource)) {
+            if (path != referencePath) inputs.push_back(path);
+        }
+        if (inputs.size() < 2) {
+            cerr << "Нет растров-кандидатов: " << batchSource << endl;
+            return 1;
+        }
+        if (job.outputPath.empty()) job.outputPath = "overlaps.geojson";
+    } else if (!batchSource.empty()) {
+        inputs = collectInputs(batchSource);
+        if (inputs.size() < 2) {
+            cerr << "Для пакетного режима нужно хотя бы два растра: " << batchSource << endl;
+            return 1;
+        }
+        if (job.outputPath.empty()) job.outputPath = "overlaps.geojson";
+    } else if (inputs.empty()) {
+        inputs = {"orto1.tif", "orto2.tif"};
+    } else if (inputs.size() != 2) {
+        cerr << "Нужно указать ровно два растра" << endl;
+        return 1;
+    }
+    if (job.outputPath.empty()) job.outputPath = "intersection_obchaja_2.geojson";
+    
+    // Пакетным режимам статистика маски (число пикселей, гистограмма) не
+    // нужна: без --verbose и явного выбора ищутся только границы, от краев
+    // внутрь, с чтением лишь нужных блоков
+    setVerbosity(verbosity);
+    if (!batchSource.empty() && !scanChosen && verbosity != Verbosity::Verbose) {
+        options.storage = MaskStorage::Streaming;
+        options.scanMode = MaskScanMode::BoundsOnly;
+    }
+    
+    // Растры в облачном хранилище: по умолчанию облачный профиль и точный
+    // поиск границ от краев внутрь; --overviews - только по запросу
+    bool remote = any_of(inputs.begin(), inputs.end(), isRemotePath);
+    if (remote && !ioProfileChosen) {
+        ioProfile.preset = IoPreset::Cloud;
+    }
+    if (remote && !scanChosen) {
+        options.storage = MaskStorage::Streaming;
+        options.scanMode = MaskScanMode::BoundsOnly;
+    }
+    applyIoProfile(ioProfile);
+    
+    shared_ptr<FootprintCache> cache;
+    if (!cachePath.empty()) {
+        cache = openFootprintCache(cachePath, options);
+        job.cache = cache.get();
+    }
+    
+    int result = 0;
+    try {
+        if (verbosity != Verbosity::Quiet) {
+            cout << "=== Анализатор пересечения растров (GEOS C API) ===\n";
+            cout << "Ядро сканирования маски: " << activeRowScanKernelName() << '\n';
+        }
+        
+        if (merge) {
+            result = runMergeMode(inputs, job);
+        } else if (job.shardCount > 1) {
+            result = runShardMode(inputs, options, job);
+        } else if (!changedList.empty()) {
+            result = runIncrementalMode(inputs, collectInputs(changedList), options, job);
+        } else if (!referencePath.empty()) {
+            result = runReferenceMode(inputs, options, job);
+        } else if (!batchSource.empty()) {
+            result = runBatchMode(inputs, options, job);
+        } else {
+            result = job.windowed
+                ? runWindowedPairMode(inputs, options, job)
+                : runPairMode(inputs, options, job);
+        }
+        
+    } catch (const exception& e) {
+        cerr << "Ошибка: " << e.what() << endl;
+        result = 1;
+    }
+    
+    if (cache) {
+        saveFootprintCache(*cache);
+    }
+    if (!metricsPath.empty() && !writeMetrics(metricsPath) && result == 0) {
+        result = 1;
+    }
+    
+    uint64_t requests = 0, bytes = 0;
+    if (remote && verbosity != Verbosity::Quiet && networkTransfer(requests, bytes)) {
+        cout << "Загружено по сети: " << bytes / (1024.0 * 1024.0) << " МБ, запросов: " << requests << '\n';
+    }
+    
+    if (verbosity != Verbosity::Quiet) {
+        cout << "\nПрограмма завершена" << endl;
+    }
+    return result;
+
+}
@@ -0,0 +1,5234 @@
+#include "raster_overlap.h"
+
+#include "gdal.h"
+#include "gdal_priv.h"
+#include "gdal_alg.h"
+#include "ogrsf_frmts.h"
+#include "ogr_spatialref.h"
+#include "cpl_vsi.h"
+#include "nlohmann/json.hpp"
+
+// C API
+#ifdef HAS_GEOS
+#include "geos_c.h"
+#endif
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <condition_variable>
+#include <sstream>
+#include <map>
+#include <set>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MASK_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define MASK_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define MASK_TARGET_AVX2
+#else
+#define MASK_TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#endif
+
+using json = nlohmann::json;
+using namespace std;
+
+#ifdef HAS_GEOS
+// ---------------------------------------------------------------------------
+// Реентерабельный GEOS: у каждого потока свой контекст (GEOS_init_r), все
+// вызовы идут через _r-функции, поэтому геометрии можно строить и
+// пересекать из нескольких потоков. Геометрия не привязана к контексту
+// и освобождается через контекст потока, в котором удаляется владелец.
+// ---------------------------------------------------------------------------
+static void geosErrorHandler(const char* message, void*) {
+    cerr << "GEOS: " << message << endl;
+}
+
+class GeosContext {
+public:
+    GeosContext() : handle(GEOS_init_r()) {
+        GEOSContext_setErrorMessageHandler_r(handle, geosErrorHandler, nullptr);
+    }
+    
+    ~GeosContext() {
+        GEOS_finish_r(handle);
+    }
+    
+    GeosContext(const GeosContext&) = delete;
+    GeosContext& operator=(const GeosContext&) = delete;
+    
+    GEOSContextHandle_t get() const {
+        return handle;
+    }
+    
+private:
+    GEOSContextHandle_t handle;
+};
+
+// Контекст GEOS текущего потока
+static GEOSContextHandle_t geosContext() {
+    thread_local GeosContext context;
+    return context.get();
+}
+
+struct GeosGeometryDeleter {
+    void operator()(GEOSGeometry* geometry) const {
+        GEOSGeom_destroy_r(geosContext(), geometry);
+    }
+};
+
+struct GeosCoordSeqDeleter {
+    void operator()(GEOSCoordSequence* coordSeq) const {
+        GEOSCoordSeq_destroy_r(geosContext(), coordSeq);
+    }
+};
+
+using GeosGeometryPtr = unique_ptr<GEOSGeometry, GeosGeometryDeleter>;
+using GeosCoordSeqPtr = unique_ptr<GEOSCoordSequence, GeosCoordSeqDeleter>;
+
+// Кольцо из последовательности; последовательность переходит во владение кольца
+static GeosGeometryPtr makeLinearRing(GeosCoordSeqPtr coordSeq) {
+    return GeosGeometryPtr(GEOSGeom_createLinearRing_r(geosContext(), coordSeq.release()));
+}
+
+// Полигон из оболочки и дыр; кольца переходят во владение полигона
+static GeosGeometryPtr makePolygon(GeosGeometryPtr shell, vector<GeosGeometryPtr> holes = {}) {
+    vector<GEOSGeometry*> raw;
+    for (GeosGeometryPtr& hole : holes) {
+        raw.push_back(hole.release());
+    }
+    return GeosGeometryPtr(GEOSGeom_createPolygon_r(geosContext(), shell.release(),
+                                                    raw.empty() ? nullptr : raw.data(),
+                                                    (unsigned)raw.size()));
+}
+
+// Коллекция заданного типа; части переходят во владение коллекции
+static GeosGeometryPtr makeCollection(int type, vector<GeosGeometryPtr> parts) {
+    vector<GEOSGeometry*> raw;
+    for (GeosGeometryPtr& part : parts) {
+        raw.push_back(part.release());
+    }
+    return GeosGeometryPtr(GEOSGeom_createCollection_r(geosContext(), type, raw.data(), (unsigned)raw.size()));
+}
+#endif
+
+// Результат единственного прохода по маске: границы данных,
+// число непрозрачных пикселей и гистограмма непрозрачных пикселей по строкам
+struct MaskStats {
+    bool foundData = false;
+    bool hasCounts = true;     // false, если считались только границы
+    int minX = 0, minY = 0, maxX = -1, maxY = -1;
+    long long opaqueCount = 0;
+    vector<uint32_t> rowCounts;
+    
+    void reset(int rows) {
+        *this = MaskStats();
+        rowCounts.assign(rows, 0);
+    }
+    
+    // Учитывает отрезок строки y: первый и последний непрозрачный столбец и их количество
+    void addRow(int y, int firstX, int lastX, int count) {
+        if (count == 0) return;
+        if (!foundData) {
+            foundData = true;
+            minX = firstX; maxX = lastX;
+            minY = maxY = y;
+        } else {
+            minX = min(minX, firstX);
+            maxX = max(maxX, lastX);
+            minY = min(minY, y);
+            maxY = max(maxY, y);
+        }
+        opaqueCount += count;
+        rowCounts[y] += count;
+    }
+    
+    // Объединяет частичный результат другого потока или тайла
+    void merge(const MaskStats& other) {
+        if (other.foundData) {
+            if (!foundData) {
+                foundData = true;
+                minX = other.minX; minY = other.minY;
+                maxX = other.maxX; maxY = other.maxY;
+            } else {
+                minX = min(minX, other.minX);
+                minY = min(minY, other.minY);
+                maxX = max(maxX, other.maxX);
+                maxY = max(maxY, other.maxY);
+            }
+        }
+        opaqueCount += other.opaqueCount;
+        for (size_t y = 0; y < rowCounts.size() && y < other.rowCounts.size(); ++y) {
+            rowCounts[y] += other.rowCounts[y];
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Ядра сканирования строки маски.
+// Каждое ядро ищет непрозрачные (== 255) пиксели в строке длиной n и возвращает
+// их количество, first/last - первый и последний столбец (-1, если нет).
+// Векторные ядра сравнивают по 64 байта за итерацию и получают битовую маску,
+// по которой позиции берутся через ctz/clz, а количество через popcount.
+// ---------------------------------------------------------------------------
+using RowScanKernel = int (*)(const uint8_t* line, int n, int& first, int& last);
+
+static inline int ctz64(uint64_t v) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return (int)index;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+static inline int clz64(uint64_t v) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanReverse64(&index, v);
+    return 63 - (int)index;
+#else
+    return __builtin_clzll(v);
+#endif
+}
+
+static inline int popcount64(uint64_t v) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return (int)__popcnt64(v);
+#else
+    return __builtin_popcountll(v);
+#endif
+}
+
+// Учитывает 64-битную маску совпадений, начинающуюся со столбца base
+static inline void accumulateMask(uint64_t mask, int base, int& first, int& last, int& count) {
+    if (!mask) return;
+    if (first < 0) first = base + ctz64(mask);
+    last = base + 63 - clz64(mask);
+    count += popcount64(mask);
+}
+
+// Скалярная обработка хвоста строки начиная со столбца x
+static inline void scanTail(const uint8_t* line, int x, int n, int& first, int& last, int& count) {
+    for (; x < n; ++x) {
+        if (line[x] == 255) {
+            if (first < 0) first = x;
+            last = x;
+            count++;
+        }
+    }
+}
+
+static int scanLineScalar(const uint8_t* line, int n, int& first, int& last) {
+    first = -1;
+    last = -1;
+    int count = 0;
+    scanTail(line, 0, n, first, last, count);
+    return count;
+}
+
+#ifdef MASK_KERNELS_X86
+static int scanLineSse2(const uint8_t* line, int n, int& first, int& last) {
+    first = -1;
+    last = -1;
+    int count = 0;
+    const __m128i opaque = _mm_set1_epi8((char)0xFF);
+    int x = 0;
+    for (; x + 64 <= n; x += 64) {
+        uint64_t m0 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*)(line + x)), opaque));
+        uint64_t m1 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*)(line + x + 16)), opaque));
+        uint64_t m2 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*)(line + x + 32)), opaque));
+        uint64_t m3 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*)(line + x + 48)), opaque));
+        accumulateMask(m0 | (m1 << 16) | (m2 << 32) | (m3 << 48), x, first, last, count);
+    }
+    scanTail(line, x, n, first, last, count);
+    return count;
+}
+
+MASK_TARGET_AVX2
+static int scanLineAvx2(const uint8_t* line, int n, int& first, int& last) {
+    first = -1;
+    last = -1;
+    int count = 0;
+    const __m256i opaque = _mm256_set1_epi8((char)0xFF);
+    int x = 0;
+    for (; x + 64 <= n; x += 64) {
+        uint64_t lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i*)(line + x)), opaque));
+        uint64_t hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i*)(line + x + 32)), opaque));
+        accumulateMask(lo | (hi << 32), x, first, last, count);
+    }
+    scanTail(line, x, n, first, last, count);
+    return count;
+}
+
+static bool cpuHasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    // OSXSAVE и AVX, плюс ОС сохраняет регистры YMM
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false;
+    if ((_xgetbv(0) & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#endif
+}
+#endif
+
+#ifdef MASK_KERNELS_NEON
+static int scanLineNeon(const uint8_t* line, int n, int& first, int& last) {
+    first = -1;
+    last = -1;
+    int count = 0;
+    const uint8x16_t opaque = vdupq_n_u8(255);
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(line + x), opaque);
+        // Сужение сдвигом дает по 4 бита на каждый байт сравнения
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (mask) {
+            if (first < 0) first = x + ctz64(mask) / 4;
+            last = x + (63 - clz64(mask)) / 4;
+            count += popcount64(mask) / 4;
+        }
+    }
+    scanTail(line, x, n, first, last, count);
+    return count;
+}
+#endif
+
+struct RowScanKernelInfo {
+    const char* name;
+    RowScanKernel kernel;
+};
+
+// Лучшее ядро, доступное на текущем процессоре
+static RowScanKernelInfo detectRowScanKernel() {
+#ifdef MASK_KERNELS_X86
+    if (cpuHasAvx2()) return {"avx2", scanLineAvx2};
+    return {"sse2", scanLineSse2};
+#elif defined(MASK_KERNELS_NEON)
+    return {"neon", scanLineNeon};
+#else
+    return {"scalar", scanLineScalar};
+#endif
+}
+
+static RowScanKernelInfo& activeRowScanKernel() {
+    static RowScanKernelInfo info = detectRowScanKernel();
+    return info;
+}
+
+bool selectRowScanKernel(const string& name) {
+    RowScanKernelInfo& info = activeRowScanKernel();
+    if (name == "auto") {
+        info = detectRowScanKernel();
+        return true;
+    }
+    if (name == "scalar") {
+        info = {"scalar", scanLineScalar};
+        return true;
+    }
+#ifdef MASK_KERNELS_X86
+    if (name == "sse2") {
+        info = {"sse2", scanLineSse2};
+        return true;
+    }
+    if (name == "avx2" && cpuHasAvx2()) {
+        info = {"avx2", scanLineAvx2};
+        return true;
+    }
+#endif
+#ifdef MASK_KERNELS_NEON
+    if (name == "neon") {
+        info = {"neon", scanLineNeon};
+        return true;
+    }
+#endif
+    return false;
+}
+
+const char* activeRowScanKernelName() {
+    return activeRowScanKernel().name;
+}
+
+static inline int scanLine(const uint8_t* line, int n, int& first, int& last) {
+    return activeRowScanKernel().kernel(line, n, first, last);
+}
+
+// ---------------------------------------------------------------------------
+// Планировщик тайлов с перехватом работы (work stealing).
+// Тайлы раздаются потокам непрерывными диапазонами; поток берет задачи с
+// начала своей очереди, а опустевший поток забирает их с конца чужих очередей.
+// ---------------------------------------------------------------------------
+class TileScheduler {
+public:
+    explicit TileScheduler(int threadCount) {
+        if (threadCount <= 0) {
+            threadCount = (int)thread::hardware_concurrency();
+        }
+        workers = max(1, threadCount);
+    }
+    
+    int size() const {
+        return workers;
+    }
+    
+    // Выполняет task(tile, worker) для каждого tile из [0, tileCount).
+    // Возвращает управление после завершения всех тайлов; первое
+    // исключение из задачи пробрасывается вызывающему.
+    void run(int tileCount, const function<void(int, int)>& task) {
+        int threadCount = min(workers, max(1, tileCount));
+        if (threadCount == 1) {
+            for (int tile = 0; tile < tileCount; ++tile) {
+                task(tile, 0);
+            }
+            return;
+        }
+        
+        vector<WorkerQueue> queues(threadCount);
+        for (int w = 0; w < threadCount; ++w) {
+            int begin = (int)((long long)tileCount * w / threadCount);
+            int end = (int)((long long)tileCount * (w + 1) / threadCount);
+            for (int tile = begin; tile < end; ++tile) {
+                queues[w].tiles.push_back(tile);
+            }
+        }
+        
+        exception_ptr failure;
+        mutex failureLock;
+        vector<thread> threads;
+        threads.reserve(threadCount);
+        
+        for (int w = 0; w < threadCount; ++w) {
+            threads.emplace_back([&, w]() {
+                int tile;
+                while (nextTile(queues, w, tile)) {
+                    try {
+                        task(tile, w);
+                    } catch (...) {
+                        lock_guard<mutex> guard(failureLock);
+                        if (!failure) failure = current_exception();
+                    }
+                }
+            });
+        }
+        
+        for (thread& t : threads) {
+            t.join();
+        }
+        if (failure) {
+            rethrow_exception(failure);
+        }
+    }
+    
+private:
+    struct WorkerQueue {
+        mutex lock;
+        deque<int> tiles;
+    };
+    
+    int workers;
+    
+    static bool nextTile(vector<WorkerQueue>& queues, int worker, int& tile) {
+        {
+            WorkerQueue& own = queues[worker];
+            lock_guard<mutex> guard(own.lock);
+            if (!own.tiles.empty()) {
+                tile = own.tiles.front();
+                own.tiles.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); ++i) {
+            WorkerQueue& victim = queues[(worker + i) % queues.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tiles.empty()) {
+                tile = victim.tiles.back();
+                victim.tiles.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Сообщения о ходе обработки. Отключенный уровень пишет в поток без буфера:
+// операторы << сразу возвращаются, не форматируя аргументы. Такой поток
+// свой у каждого потока выполнения: запись меняет его состояние.
+// ---------------------------------------------------------------------------
+static atomic<int> currentVerbosity((int)Verbosity::Normal);
+
+void setVerbosity(Verbosity verbosity) {
+    currentVerbosity = (int)verbosity;
+}
+
+static bool logEnabled(Verbosity level) {
+    return currentVerbosity >= (int)level;
+}
+
+static ostream& progress(Verbosity level = Verbosity::Normal) {
+    static thread_local ostream discard(nullptr);
+    return logEnabled(level) ? cout : discard;
+}
+
+// ---------------------------------------------------------------------------
+// Настройка GDAL на процесс: регистрация драйверов ровно один раз и профиль
+// ввода-вывода (параметры конфигурации читаются драйверами при открытии).
+// ---------------------------------------------------------------------------
+static void registerDrivers() {
+    static once_flag registered;
+    call_once(registered, []() {
+        // Учет сетевых запросов включается до первого обращения к сети
+        if (!CPLGetConfigOption("CPL_VSIL_NETWORK_STATS_ENABLED", nullptr)) {
+            CPLSetConfigOption("CPL_VSIL_NETWORK_STATS_ENABLED", "YES");
+        }
+        GDALAllRegister();
+    });
+}
+
+// Значение по профилю: не меняет параметр, заданный окружением или ранее
+static void setConfigDefault(const char* key, const char* value) {
+    if (!CPLGetConfigOption(key, nullptr)) {
+        CPLSetConfigOption(key, value);
+    }
+}
+
+void applyIoProfile(const IoProfile& profile) {
+    if (profile.preset == IoPreset::Cloud) {
+        setConfigDefault("GDAL_CACHEMAX", "1024");
+        setConfigDefault("GDAL_NUM_THREADS", "ALL_CPUS");
+        // Кэш блоков файлов VSI и /vsicurl/ поверх блочного кэша GDAL
+        setConfigDefault("VSI_CACHE", "TRUE");
+        setConfigDefault("VSI_CACHE_SIZE", "268435456");
+        setConfigDefault("CPL_VSIL_CURL_CACHE_SIZE", "268435456");
+        // Заголовок и IFD COG одним запросом, без листинга каталога
+        setConfigDefault("GDAL_INGESTED_BYTES_AT_OPEN", "65536");
+        setConfigDefault("GDAL_DISABLE_READDIR_ON_OPEN", "EMPTY_DIR");
+        // Соседние тайлы - одним диапазоном, несколько диапазонов - одним
+        // запросом, запросы - по одному соединению HTTP/2
+        setConfigDefault("GDAL_HTTP_MERGE_CONSECUTIVE_RANGES", "YES");
+        setConfigDefault("GDAL_HTTP_MULTIRANGE", "YES");
+        setConfigDefault("GDAL_HTTP_MULTIPLEX", "YES");
+        setConfigDefault("GDAL_HTTP_VERSION", "2");
+        setConfigDefault("GDAL_HTTP_MAX_RETRY", "3");
+        setConfigDefault("GDAL_HTTP_RETRY_DELAY", "1");
+    }
+    
+    if (profile.decodeThreads == 0) {
+        CPLSetConfigOption("GDAL_NUM_THREADS", "ALL_CPUS");
+    } else if (profile.decodeThreads > 0) {
+        CPLSetConfigOption("GDAL_NUM_THREADS", to_string(profile.decodeThreads).c_str());
+    }
+    // Кэш мог быть уже создан, поэтому размер задается и напрямую
+    if (profile.cacheMaxMb > 0) {
+        CPLSetConfigOption("GDAL_CACHEMAX", to_string(profile.cacheMaxMb).c_str());
+        GDALSetCacheMax64((GIntBig)profile.cacheMaxMb * 1024 * 1024);
+    }
+}
+
+string gdalPath(const string& path) {
+    static const pair<const char*, const char*> schemes[] = {
+        {"s3://", "/vsis3/"}, {"gs://", "/vsigs/"}, {"az://", "/vsiaz/"},
+        {"http://", "/vsicurl/http://"}, {"https://", "/vsicurl/https://"}
+    };
+    for (const auto& scheme : schemes) {
+        size_t length = strlen(scheme.first);
+        if (path.compare(0, length, scheme.first) == 0) {
+            return scheme.second + path.substr(length);
+        }
+    }
+    return path;
+}
+
+bool isRemotePath(const string& path) {
+    static const char* prefixes[] = {
+        "/vsicurl", "/vsis3", "/vsigs", "/vsiaz", "/vsiadls", "/vsioss", "/vsiswift", "/vsiwebhdfs"
+    };
+    string normalized = gdalPath(path);
+    for (const char* prefix : prefixes) {
+        if (normalized.find(prefix) != string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Статистика сетевых обработчиков VSI (GDAL 3.2+): сумма по методам HTTP
+bool networkTransfer(uint64_t& requests, uint64_t& bytes) {
+    requests = 0;
+    bytes = 0;
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3, 2, 0)
+    char* serialized = VSINetworkStatsGetAsSerializedJSON(nullptr);
+    if (!serialized) {
+        return false;
+    }
+    json stats = json::parse(serialized, nullptr, false);
+    CPLFree(serialized);
+    if (!stats.is_object() || !stats.contains("methods") || !stats["methods"].is_object()) {
+        return true;    // сетевых обращений не было
+    }
+    for (const auto& method : stats["methods"].items()) {
+        requests += method.value().value("count", (uint64_t)0);
+        bytes += method.value().value("downloaded_bytes", (uint64_t)0);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Метрики горячих путей: время стадий, объем чтения каналов, попадания в
+// блочный кэш GDAL, пиковый RSS и процессорное время процесса. Счетчики
+// общие для всех потоков (атомарные). Время стадии - на потоке, который ее
+// выполняет, без вложенных стадий того же потока (чтение внутри анализа
+// маски засчитывается чтению); при нескольких потоках сумма стадий может
+// превышать wall-время. Близкое к wall процессорное время на поток говорит
+// о счетной задаче, далекое - об ожидании ввода-вывода.
+// ---------------------------------------------------------------------------
+enum class Stage {
+    Open,           // GDALOpen и метаданные
+    Read,           // чтение пикселей маски
+    Scan,           // анализ маски
+    Geometry,       // построение и перепроецирование валидной области
+    Intersection,   // пересечения областей
+    Serialize,      // запись результата
+    Count
+};
+
+static const char* stageName(Stage stage) {
+    static const char* names[] = {"open", "read", "scan", "geometry", "intersection", "serialize"};
+    return names[(int)stage];
+}
+
+class Metrics {
+public:
+    static Metrics& global() {
+        static Metrics metrics;
+        return metrics;
+    }
+    
+    void addStage(Stage stage, uint64_t nanoseconds) {
+        stageNanoseconds[(int)stage] += nanoseconds;
+        stageCalls[(int)stage]++;
+    }
+    
+    void addRead(uint64_t bytes, uint64_t blocks) {
+        bytesRead += bytes;
+        blocksRead += blocks;
+    }
+    
+    void addBlockLookup(bool hit) {
+        (hit ? cacheHits : cacheMisses)++;
+    }
+    
+    // Блок без данных в файле (разреженный TIFF/COG), не читался
+    void addEmptyBlock() {
+        emptyBlocks++;
+    }
+    
+    // JSON lines: по строке на стадию и итоговая строка
+    void writeJsonLines(ostream& out) const {
+        for (int i = 0; i < (int)Stage::Count; ++i) {
+            out << json{
+                {"stage", stageName((Stage)i)},
+                {"calls", stageCalls[i].load()},
+                {"seconds", stageNanoseconds[i] * 1e-9}
+            }.dump() << '\n';
+        }
+        json summary = {
+            {"wall_seconds", wallSeconds()},
+            {"cpu_seconds", processCpuSeconds()},
+            {"bytes_read", bytesRead.load()},
+            {"blocks_read", blocksRead.load()},
+            {"block_cache_hits", cacheHits.load()},
+            {"block_cache_misses", cacheMisses.load()},
+            {"block_cache_hit_rate", nullptr},
+            {"empty_blocks_skipped", emptyBlocks.load()},
+            {"network_requests", nullptr},
+            {"network_bytes", nullptr},
+            {"peak_rss_bytes", peakResidentBytes()}
+        };
+        uint64_t lookups = cacheHits + cacheMisses;
+        if (lookups > 0) {
+            summary["block_cache_hit_rate"] = (double)cacheHits / lookups;
+        }
+        uint64_t requests = 0, bytes = 0;
+        if (networkTransfer(requests, bytes)) {
+            summary["network_requests"] = requests;
+            summary["network_bytes"] = bytes;
+        }
+        out << summary.dump() << '\n';
+    }
+    
+    // Текстовый формат Prometheus (node_exporter textfile collector и т.п.)
+    void writePrometheus(ostream& out) const {
+        out << "# HELP raster_overlap_stage_seconds_total Время стадий, суммарно по потокам\n"
+            << "# TYPE raster_overlap_stage_seconds_total counter\n";
+        for (int i = 0; i < (int)Stage::Count; ++i) {
+            out << "raster_overlap_stage_seconds_total{stage=\"" << stageName((Stage)i) << "\"} "
+                << stageNanoseconds[i] * 1e-9 << '\n';
+        }
+        out << "# TYPE raster_overlap_stage_calls_total counter\n";
+        for (int i = 0; i < (int)Stage::Count; ++i) {
+            out << "raster_overlap_stage_calls_total{stage=\"" << stageName((Stage)i) << "\"} "
+                << stageCalls[i] << '\n';
+        }
+        out << "# TYPE raster_overlap_wall_seconds gauge\n"
+            << "raster_overlap_wall_seconds " << wallSeconds() << '\n'
+            << "# TYPE raster_overlap_cpu_seconds gauge\n"
+            << "raster_overlap_cpu_seconds " << processCpuSeconds() << '\n'
+            << "# TYPE raster_overlap_read_bytes_total counter\n"
+            << "raster_overlap_read_bytes_total " << bytesRead << '\n'
+            << "# TYPE raster_overlap_read_blocks_total counter\n"
+            << "raster_overlap_read_blocks_total " << blocksRead << '\n'
+            << "# HELP raster_overlap_block_cache_lookups_total Поблочные чтения маски по наличию блока в кэше GDAL\n"
+            << "# TYPE raster_overlap_block_cache_lookups_total counter\n"
+            << "raster_overlap_block_cache_lookups_total{result=\"hit\"} " << cacheHits << '\n'
+            << "raster_overlap_block_cache_lookups_total{result=\"miss\"} " << cacheMisses << '\n'
+            << "# TYPE raster_overlap_empty_blocks_skipped_total counter\n"
+            << "raster_overlap_empty_blocks_skipped_total " << emptyBlocks << '\n'
+            << "# TYPE raster_overlap_peak_rss_bytes gauge\n"
+            << "raster_overlap_peak_rss_bytes " << peakResidentBytes() << '\n';
+        uint64_t requests = 0, bytes = 0;
+        if (networkTransfer(requests, bytes)) {
+            out << "# HELP raster_overlap_network_requests_total Запросы HTTP сетевых путей VSI\n"
+                << "# TYPE raster_overlap_network_requests_total counter\n"
+                << "raster_overlap_network_requests_total " << requests << '\n'
+                << "# TYPE raster_overlap_network_bytes_total counter\n"
+                << "raster_overlap_network_bytes_total " << bytes << '\n';
+        }
+    }
+    
+    // Пиковый размер резидентной памяти процесса в байтах, 0 - неизвестен
+    static uint64_t peakResidentBytes() {
+    #if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return (uint64_t)counters.PeakWorkingSetSize;
+        }
+        return 0;
+    #else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0;
+        }
+        #if defined(__APPLE__)
+        return (uint64_t)usage.ru_maxrss;           // байты
+        #else
+        return (uint64_t)usage.ru_maxrss * 1024;    // килобайты
+        #endif
+    #endif
+    }
+    
+    static double processCpuSeconds() {
+    #if defined(_WIN32)
+        FILETIME created, exited, kernel, user;
+        if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+            return 0.0;
+        }
+        auto seconds = [](const FILETIME& time) {
+            return (((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime) * 1e-7;
+        };
+        return seconds(kernel) + seconds(user);
+    #else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0.0;
+        }
+        return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+               usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+    #endif
+    }
+    
+private:
+    Metrics() : started(chrono::steady_clock::now()) {}
+    
+    double wallSeconds() const {
+        return chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    }
+    
+    chrono::steady_clock::time_point started;
+    atomic<uint64_t> stageNanoseconds[(int)Stage::Count] = {};
+    atomic<uint64_t> stageCalls[(int)Stage::Count] = {};
+    atomic<uint64_t> bytesRead{0};
+    atomic<uint64_t> blocksRead{0};
+    atomic<uint64_t> cacheHits{0};
+    atomic<uint64_t> cacheMisses{0};
+    atomic<uint64_t> emptyBlocks{0};
+};
+
+// Замер стадии на время жизни объекта. Вложенные замеры того же потока
+// вычитаются из внешнего, так что каждая наносекунда засчитывается одной стадии.
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage)
+        : stage(stage), start(chrono::steady_clock::now()), outerNested(nestedNanoseconds) {
+        nestedNanoseconds = 0;
+    }
+    
+    ~StageTimer() {
+        uint64_t elapsed = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start).count();
+        uint64_t nested = nestedNanoseconds;
+        Metrics::global().addStage(stage, elapsed > nested ? elapsed - nested : 0);
+        nestedNanoseconds = outerNested + elapsed;
+    }
+    
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+    
+private:
+    Stage stage;
+    chrono::steady_clock::time_point start;
+    uint64_t outerNested;
+    
+    static thread_local uint64_t nestedNanoseconds;
+};
+
+thread_local uint64_t StageTimer::nestedNanoseconds = 0;
+
+// Число блоков канала, которые покрывает окно (для счетчика прочитанных блоков)
+static uint64_t windowBlockCount(GDALRasterBand* band, int xOff, int yOff, int xSize, int ySize) {
+    int blockXSize = 0, blockYSize = 0;
+    band->GetBlockSize(&blockXSize, &blockYSize);
+    if (blockXSize <= 0 || blockYSize <= 0 || xSize <= 0 || ySize <= 0) {
+        return 0;
+    }
+    uint64_t columns = (uint64_t)((xOff + xSize - 1) / blockXSize - xOff / blockXSize + 1);
+    uint64_t rows = (uint64_t)((yOff + ySize - 1) / blockYSize - yOff / blockYSize + 1);
+    return columns * rows;
+}
+
+// RasterIO чтения байтового окна маски с учетом в метриках
+static CPLErr readBandWindow(GDALRasterBand* band, int xOff, int yOff, int xSize, int ySize,
+                             void* data, int bufXSize, int bufYSize, GSpacing pixelSpace, GSpacing lineSpace) {
+    StageTimer timer(Stage::Read);
+    band->AdviseRead(xOff, yOff, xSize, ySize, bufXSize, bufYSize, GDT_Byte, nullptr);
+    CPLErr err = band->RasterIO(GF_Read, xOff, yOff, xSize, ySize, data, bufXSize, bufYSize,
+                                GDT_Byte, pixelSpace, lineSpace);
+    if (err == CE_None) {
+        Metrics::global().addRead((uint64_t)bufXSize * bufYSize,
+                                  windowBlockCount(band, xOff, yOff, xSize, ySize));
+    }
+    return err;
+}
+
+// ---------------------------------------------------------------------------
+// Маска в виде отрезков непрозрачных пикселей по строкам.
+// Отрезки [start, end) всех строк лежат подряд, rowOffsets[y] - начало строки y
+// (как в CSR). Память пропорциональна числу переходов 0/255, а подсчет,
+// границы и векторизация сводятся к арифметике отрезков.
+// ---------------------------------------------------------------------------
+struct MaskSpan {
+    int start, end;
+};
+
+// Дописывает в out отрезки непрозрачных пикселей сегмента строки длиной n,
+// начинающегося со столбца x0. Отрезок, продолжающий последний в out,
+// склеивается с ним. Однородные 8-байтовые слова (0 или 255) пропускаются целиком.
+static void appendLineSpans(const uint8_t* line, int n, int x0, vector<MaskSpan>& out) {
+    int x = 0;
+    while (x < n) {
+        // Поиск начала отрезка
+        while (x + 8 <= n) {
+            uint64_t word;
+            memcpy(&word, line + x, 8);
+            if (word != 0) break;
+            x += 8;
+        }
+        while (x < n && line[x] != 255) ++x;
+        if (x >= n) break;
+        
+        int start = x;
+        while (x + 8 <= n) {
+            uint64_t word;
+            memcpy(&word, line + x, 8);
+            if (word != ~0ull) break;
+            x += 8;
+        }
+        while (x < n && line[x] == 255) ++x;
+        
+        if (!out.empty() && out.back().end == x0 + start) {
+            out.back().end = x0 + x;
+        } else {
+            out.push_back({x0 + start, x0 + x});
+        }
+    }
+}
+
+class MaskSpans {
+public:
+    int width = 0, height = 0;
+    vector<MaskSpan> spans;
+    vector<size_t> rowOffsets;  // height + 1 элементов
+    
+    size_t rowBegin(int y) const { return rowOffsets[y]; }
+    size_t rowEnd(int y) const { return rowOffsets[y + 1]; }
+    
+    // Границы, количество и гистограмма по строкам без обращения к пикселям
+    MaskStats computeStats() const {
+        MaskStats stats;
+        stats.reset(height);
+        for (int y = 0; y < height; ++y) {
+            size_t b = rowBegin(y), e = rowEnd(y);
+            if (b == e) continue;
+            int count = 0;
+            for (size_t i = b; i < e; ++i) {
+                count += spans[i].end - spans[i].start;
+            }
+            stats.addRow(y, spans[b].start, spans[e - 1].end - 1, count);
+        }
+        return stats;
+    }
+    
+    size_t memoryBytes() const {
+        return spans.size() * sizeof(MaskSpan) + rowOffsets.size() * sizeof(size_t);
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Битовая маска: 1 бит на пиксель (бит x строки y - пиксель непрозрачен).
+// Строка занимает целое число 64-битных слов, биты за шириной всегда нули,
+// поэтому подсчет - это popcount по словам, границы - поиск ненулевых слов
+// с ctz/clz, а пересечение двух выровненных масок - побитовое AND.
+// ---------------------------------------------------------------------------
+class BitMask {
+public:
+    int width = 0, height = 0;
+    size_t wordsPerRow = 0;
+    vector<uint64_t> words;
+    
+    void reset(int w, int h) {
+        width = w;
+        height = h;
+        wordsPerRow = ((size_t)w + 63) / 64;
+        words.assign(wordsPerRow * h, 0);
+    }
+    
+    const uint64_t* row(int y) const { return &words[(size_t)y * wordsPerRow]; }
+    uint64_t* row(int y) { return &words[(size_t)y * wordsPerRow]; }
+    
+    // Упаковывает сегмент строки y длиной n, начинающийся со столбца x0
+    void packLine(int y, int x0, const uint8_t* line, int n) {
+        uint64_t* dst = row(y);
+        int i = 0;
+        for (; i + 64 <= n; i += 64) {
+            orBits(dst, x0 + i, opaqueBits64(line + i), 64);
+        }
+        if (i < n) {
+            uint64_t bits = 0;
+            for (int k = 0; i + k < n; ++k) {
+                bits |= (uint64_t)(line[i + k] == 255) << k;
+            }
+            orBits(dst, x0 + i, bits, n - i);
+        }
+    }
+    
+    int rowCount(int y) const {
+        const uint64_t* r = row(y);
+        int count = 0;
+        for (size_t i = 0; i < wordsPerRow; ++i) {
+            count += popcount64(r[i]);
+        }
+        return count;
+    }
+    
+    long long count() const {
+        long long total = 0;
+        for (uint64_t word : words) {
+            total += popcount64(word);
+        }
+        return total;
+    }
+    
+    // Первый и последний непрозрачный столбец строки по ненулевым словам
+    bool rowBounds(int y, int& first, int& last) const {
+        const uint64_t* r = row(y);
+        size_t lo = 0, hi = wordsPerRow;
+        while (lo < hi && r[lo] == 0) ++lo;
+        if (lo == hi) return false;
+        while (r[hi - 1] == 0) --hi;
+        first = (int)(lo * 64) + ctz64(r[lo]);
+        last = (int)((hi - 1) * 64) + 63 - clz64(r[hi - 1]);
+        return true;
+    }
+    
+    MaskStats computeStats() const {
+        MaskStats stats;
+        stats.reset(height);
+        for (int y = 0; y < height; ++y) {
+            int first, last;
+            if (rowBounds(y, first, last)) {
+                stats.addRow(y, first, last, rowCount(y));
+            }
+        }
+        return stats;
+    }
+    
+    bool sameShape(const BitMask& other) const {
+        return width == other.width && height == other.height;
+    }
+    
+    // Число пикселей, непрозрачных в обеих масках, без изменения масок
+    long long countAnd(const BitMask& other) const {
+        long long total = 0;
+        for (size_t i = 0; i < words.size(); ++i) {
+            total += popcount64(words[i] & other.words[i]);
+        }
+        return total;
+    }
+    
+    size_t memoryBytes() const {
+        return words.size() * sizeof(uint64_t);
+    }
+    
+private:
+    // Записывает count младших бит bits начиная с бита bitPos строки
+    static void orBits(uint64_t* dst, int bitPos, uint64_t bits, int count) {
+        size_t word = (size_t)bitPos >> 6;
+        int shift = bitPos & 63;
+        dst[word] |= bits << shift;
+        if (shift != 0 && shift + count > 64) {
+            dst[word + 1] |= bits >> (64 - shift);
+        }
+    }
+    
+    // Маска сравнения 64 байт с 255
+    static uint64_t opaqueBits64(const uint8_t* p) {
+#ifdef MASK_KERNELS_X86
+        const __m128i opaque = _mm_set1_epi8((char)0xFF);
+        uint64_t m0 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), opaque));
+        uint64_t m1 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), opaque));
+        uint64_t m2 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), opaque));
+        uint64_t m3 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), opaque));
+        return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+#else
+        uint64_t bits = 0;
+        for (int k = 0; k < 64; ++k) {
+            bits |= (uint64_t)(p[k] == 255) << k;
+        }
+        return bits;
+#endif
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Источники тайлов маски: общий интерфейс для маски в памяти и поблочного
+// чтения канала GDAL, чтобы алгоритмы обхода не зависели от хранения.
+// ---------------------------------------------------------------------------
+class MaskTileSource {
+public:
+    virtual ~MaskTileSource() {}
+    
+    virtual int tileWidth() const = 0;
+    virtual int tileHeight() const = 0;
+    
+    // Тайл (tx, ty): validX/validY - фактический размер у края растра,
+    // stride - шаг строки в байтах. nullptr при ошибке чтения.
+    virtual const uint8_t* readTile(int tx, int ty, int& validX, int& validY, size_t& stride) = 0;
+    
+    // Подсказка: скоро будут прочитаны тайлы [txBegin, txEnd] x [tyBegin, tyEnd]
+    virtual void adviseTiles(int /*txBegin*/, int /*tyBegin*/, int /*txEnd*/, int /*tyEnd*/) {}
+};
+
+// Маска целиком в памяти, тайл - полоса строк на всю ширину
+class DenseTileSource : public MaskTileSource {
+public:
+    // lineStride 0 - строки подряд, по width байт
+    DenseTileSource(const uint8_t* data, int width, int height, size_t lineStride = 0, int bandRows = 256)
+        : data(data), width(width), height(height), rows(bandRows),
+          lineStride(lineStride ? lineStride : (size_t)width) {}
+    
+    int tileWidth() const override { return width; }
+    int tileHeight() const override { return rows; }
+    
+    const uint8_t* readTile(int, int ty, int& validX, int& validY, size_t& stride) override {
+        validX = width;
+        validY = min(rows, height - ty * rows);
+        stride = lineStride;
+        return data + (size_t)ty * rows * lineStride;
+    }
+    
+private:
+    const uint8_t* data;
+    int width, height, rows;
+    size_t lineStride;
+};
+
+struct VirtualMemDeleter {
+    void operator()(CPLVirtualMem* memory) const {
+        CPLVirtualMemFree(memory);
+    }
+};
+
+using VirtualMemPtr = unique_ptr<CPLVirtualMem, VirtualMemDeleter>;
+
+// Байтовый канал без сжатия (GeoTIFF, ENVI и другие raw-форматы),
+// отображенный в память напрямую из файла: пиксели читаются из кэша
+// страниц без копирования. nullptr - раскладка не позволяет (сжатие,
+// чередование каналов по пикселям, другой тип, платформа без mmap).
+static VirtualMemPtr mapBand(GDALRasterBand* band, const uint8_t*& data, size_t& lineStride) {
+    if (band->GetRasterDataType() != GDT_Byte) {
+        return nullptr;
+    }
+    // Без эмуляции через RasterIO по страницам: она медленнее обычного чтения
+    char** mapOptions = CSLSetNameValue(nullptr, "USE_DEFAULT_IMPLEMENTATION", "NO");
+    int pixelSpace = 0;
+    GIntBig lineSpace = 0;
+    CPLPushErrorHandler(CPLQuietErrorHandler);
+    VirtualMemPtr memory(band->GetVirtualMemAuto(GF_Read, &pixelSpace, &lineSpace, mapOptions));
+    CPLPopErrorHandler();
+    CSLDestroy(mapOptions);
+    
+    if (!memory || pixelSpace != 1 || lineSpace < band->GetXSize()) {
+        return nullptr;
+    }
+    data = static_cast<const uint8_t*>(CPLVirtualMemGetAddr(memory.get()));
+    lineStride = (size_t)lineSpace;
+    return memory;
+}
+
+// Блоки канала GDAL в естественном размере, в памяти только текущий блок
+class BandTileSource : public MaskTileSource {
+public:
+    explicit BandTileSource(GDALRasterBand* band) : band(band) {
+        band->GetBlockSize(&blockXSize, &blockYSize);
+        block.resize((size_t)max(blockXSize, 0) * max(blockYSize, 0));
+        // Отсутствующий тайл GDAL заполняет значением nodata канала
+        int hasNoData = 0;
+        double noData = band->GetNoDataValue(&hasNoData);
+        sparseAsTransparent = !hasNoData || noData == 0.0;
+    }
+    
+    int tileWidth() const override { return blockXSize; }
+    int tileHeight() const override { return blockYSize; }
+    
+    // AdviseRead: драйвер может заранее запросить эти блоки, для COG по
+    // /vsicurl/ - одним запросом на несколько диапазонов
+    void adviseTiles(int txBegin, int tyBegin, int txEnd, int tyEnd) override {
+        int x0 = txBegin * blockXSize, y0 = tyBegin * blockYSize;
+        int x1 = min(band->GetXSize(), (txEnd + 1) * blockXSize);
+        int y1 = min(band->GetYSize(), (tyEnd + 1) * blockYSize);
+        if (x1 > x0 && y1 > y0) {
+            band->AdviseRead(x0, y0, x1 - x0, y1 - y0, x1 - x0, y1 - y0, GDT_Byte, nullptr);
+        }
+    }
+    
+    const uint8_t* readTile(int tx, int ty, int& validX, int& validY, size_t& stride) override {
+        if (band->GetActualBlockSize(tx, ty, &validX, &validY) != CE_None) {
+            return nullptr;
+        }
+        stride = blockXSize;
+        
+        // Тайл, отсутствующий в файле (разреженный COG: нулевое смещение в
+        // IFD), читается как прозрачный - без запроса к хранилищу
+        if (sparseAsTransparent && band->GetDataCoverageStatus(tx * blockXSize, ty * blockYSize, validX, validY) ==
+                                       GDAL_DATA_COVERAGE_STATUS_EMPTY) {
+            Metrics::global().addEmptyBlock();
+            fill(block.begin(), block.end(), (uint8_t)0);
+            return block.data();
+        }
+        
+        // Блоки кэша GDAL хранятся в собственном типе канала, поэтому
+        // для не-байтовых каналов читаем окно блока через RasterIO.
+        // Байтовый блок берется через кэш блоков: при промахе GetLockedBlockRef
+        // читает его и кладет в кэш, так что угловые блоки, общие для проходов
+        // с разных краев, не распаковываются повторно. TryGetLockedBlockRef
+        // перед этим только проверяет наличие блока для счетчика попаданий.
+        StageTimer timer(Stage::Read);
+        CPLErr err;
+        if (band->GetRasterDataType() == GDT_Byte) {
+            GDALRasterBlock* cached = band->TryGetLockedBlockRef(tx, ty);
+            Metrics::global().addBlockLookup(cached != nullptr);
+            if (!cached) {
+                cached = band->GetLockedBlockRef(tx, ty);
+            }
+            if (cached) {
+                memcpy(block.data(), cached->GetDataRef(), block.size());
+                cached->DropLock();
+                err = CE_None;
+            } else {
+                err = CE_Failure;
+            }
+        } else {
+            err = band->RasterIO(GF_Read, tx * blockXSize, ty * blockYSize,
+                                 validX, validY, block.data(), validX, validY,
+                                 GDT_Byte, 1, blockXSize);
+        }
+        if (err == CE_None) {
+            Metrics::global().addRead((uint64_t)validX * validY, 1);
+        }
+        if (err != CE_None) {
+            cerr << "Ошибка чтения блока [" << tx << "," << ty << "]" << endl;
+            return nullptr;
+        }
+        
+        return block.data();
+    }
+    
+private:
+    GDALRasterBand* band;
+    int blockXSize = 0, blockYSize = 0;
+    vector<uint8_t> block;
+    bool sparseAsTransparent = true;
+};
+
+// Прямоугольное окно растра в пикселях (как смещения и размеры в RasterIO)
+struct PixelWindow {
+    int xOff = 0, yOff = 0, xSize = 0, ySize = 0;
+    
+    int xEnd() const { return xOff + xSize; }
+    int yEnd() const { return yOff + ySize; }
+    bool empty() const { return xSize <= 0 || ySize <= 0; }
+};
+
+// Прямоугольник в географических координатах со сторонами по осям.
+// Пересечение двух таких прямоугольников - снова прямоугольник, поэтому
+// для прямоугольных областей GEOS не нужен. Касание по стороне дает
+// пустой прямоугольник: в результат попадают только пересечения с площадью.
+struct GeoBox {
+    double minX = 0, minY = 0, maxX = 0, maxY = 0;
+    
+    bool empty() const { return !(minX < maxX && minY < maxY); }
+    double area() const { return empty() ? 0.0 : (maxX - minX) * (maxY - minY); }
+    
+    GeoBox intersection(const GeoBox& other) const {
+        GeoBox result;
+        result.minX = max(minX, other.minX);
+        result.minY = max(minY, other.minY);
+        result.maxX = min(maxX, other.maxX);
+        result.maxY = min(maxY, other.maxY);
+        return result;
+    }
+};
+
+// Поиск границ данных от краев окна внутрь. Сверху и снизу строки
+// перебираются до первой непрозрачной, затем внутри найденного диапазона
+// строк слева и справа проверяются только столбцы за текущей границей.
+// Каждое направление останавливается, как только его ответ известен, и
+// читаются только тайлы, пересекающие окно. Заполняет только границы: hasCounts = false.
+static bool findBoundsEdgeInward(MaskTileSource& source, const PixelWindow& window, MaskStats& stats) {
+    stats.reset(0);
+    stats.hasCounts = false;
+    if (window.empty()) {
+        return true;
+    }
+    
+    const int tw = source.tileWidth(), th = source.tileHeight();
+    const int txBegin = window.xOff / tw, txEnd = (window.xEnd() - 1) / tw;
+    const int tyBegin = window.yOff / th, tyEnd = (window.yEnd() - 1) / th;
+    int validX, validY, first, last;
+    size_t stride;
+    
+    // Отрезок [colBegin, colEnd) строки row тайла (tx, ty), обрезанный окном
+    auto clipColumns = [&](int tx, int& colBegin, int& colEnd) {
+        colBegin = max(0, window.xOff - tx * tw);
+        colEnd = min(validX, window.xEnd() - tx * tw);
+    };
+    
+    // Сверху вниз: первая строка с непрозрачным пикселем
+    int minY = window.yEnd();
+    for (int ty = tyBegin; ty <= tyEnd && minY == window.yEnd(); ++ty) {
+        source.adviseTiles(txBegin, ty, txEnd, ty);
+        for (int tx = txBegin; tx <= txEnd; ++tx) {
+            const uint8_t* tile = source.readTile(tx, ty, validX, validY, stride);
+            if (!tile) return false;
+            int colBegin, colEnd;
+            clipColumns(tx, colBegin, colEnd);
+            int rowEnd = min(validY, window.yEnd() - ty * th);
+            for (int row = max(0, window.yOff - ty * th); row < rowEnd && ty * th + row < minY; ++row) {
+                if (scanLine(tile + row * stride + colBegin, colEnd - colBegin, first, last) > 0) {
+                    minY = ty * th + row;
+                }
+            }
+        }
+    }
+    if (minY == window.yEnd()) {
+        return true;
+    }
+    
+    // Снизу вверх до найденной верхней строки
+    int maxY = minY;
+    for (int ty = tyEnd; ty >= minY / th && maxY == minY; --ty) {
+        source.adviseTiles(txBegin, ty, txEnd, ty);
+        for (int tx = txBegin; tx <= txEnd; ++tx) {
+            const uint8_t* tile = source.readTile(tx, ty, validX, validY, stride);
+            if (!tile) return false;
+            int colBegin, colEnd;
+            clipColumns(tx, colBegin, colEnd);
+            int rowBegin = max(0, window.yOff - ty * th);
+            for (int row = min(validY, window.yEnd() - ty * th) - 1;
+                 row >= rowBegin && ty * th + row > maxY; --row) {
+                if (scanLine(tile + row * stride + colBegin, colEnd - colBegin, first, last) > 0) {
+                    maxY = ty * th + row;
+                }
+            }
+        }
+    }
+    
+    const int tyDataBegin = minY / th, tyDataEnd = maxY / th;
+    
+    // Слева направо: в каждой строке проверяется только префикс до текущей границы
+    int minX = window.xEnd();
+    for (int tx = txBegin; tx <= txEnd && minX == window.xEnd(); ++tx) {
+        source.adviseTiles(tx, tyDataBegin, tx, tyDataEnd);
+        for (int ty = tyDataBegin; ty <= tyDataEnd; ++ty) {
+            const uint8_t* tile = source.readTile(tx, ty, validX, validY, stride);
+            if (!tile) return false;
+            int colBegin, colEnd;
+            clipColumns(tx, colBegin, colEnd);
+            int rowBegin = max(0, minY - ty * th), rowEnd = min(validY, maxY - ty * th + 1);
+            for (int row = rowBegin; row < rowEnd; ++row) {
+                int limit = min(colEnd, minX - tx * tw);
+                if (limit <= colBegin) break;
+                if (scanLine(tile + row * stride + colBegin, limit - colBegin, first, last) > 0) {
+                    minX = tx * tw + colBegin + first;
+                }
+            }
+        }
+    }
+    
+    // Справа налево: проверяется только суффикс за текущей границей
+    int maxX = -1;
+    for (int tx = txEnd; tx >= minX / tw && maxX < 0; --tx) {
+        source.adviseTiles(tx, tyDataBegin, tx, tyDataEnd);
+        for (int ty = tyDataBegin; ty <= tyDataEnd; ++ty) {
+            const uint8_t* tile = source.readTile(tx, ty, validX, validY, stride);
+            if (!tile) return false;
+            int colBegin, colEnd;
+            clipColumns(tx, colBegin, colEnd);
+            int rowBegin = max(0, minY - ty * th), rowEnd = min(validY, maxY - ty * th + 1);
+            for (int row = rowBegin; row < rowEnd; ++row) {
+                int start = max(colBegin, maxX + 1 - tx * tw);
+                if (start >= colEnd) break;
+                if (scanLine(tile + row * stride + start, colEnd - start, first, last) > 0) {
+                    maxX = tx * tw + start + last;
+                }
+            }
+        }
+    }
+    
+    stats.foundData = true;
+    stats.minX = minX;
+    stats.minY = minY;
+    stats.maxX = maxX;
+    stats.maxY = maxY;
+    return true;
+}
+
+// Откуда берется маска валидных пикселей
+enum class MaskOrigin {
+    None,
+    AlphaBand,  // отдельный альфа-канал набора данных
+    MaskBand,   // GetMaskBand(): маска набора, .msk, внутренняя маска или nodata
+    AllValid    // GMF_ALL_VALID: валиден весь растр, чтение не требуется
+};
+
+class RasterProcessor {
+private:
+    GDALDataset* dataset;
+    bool ownsDataset;       // false - набор передан вызывающим (attachDataset)
+    string sourceName;
+    MaskOrigin maskOrigin;
+    int maskBandIndex;
+    GDALRasterBand* maskBand;
+    int width, height;
+    vector<uint8_t> maskData;
+    VirtualMemPtr maskMapping;      // отображение канала вместо maskData
+    const uint8_t* maskPixels;      // плотная маска: maskData или отображение
+    size_t maskLineStride;
+    MaskSpans maskSpans;
+    BitMask maskBits;
+    MaskStats maskStats;
+    bool maskScanned;
+    ProcessorOptions options;
+    ostream* logStream;
+    ostream silentLog;      // поток без буфера для отключенных сообщений
+    double geoTransform[6];
+    bool hasGeoTransform;
+    string spatialRefWkt;   // CRS набора в WKT, пустая - не задана
+    
+public:
+    RasterProcessor(const ProcessorOptions& opts = ProcessorOptions())
+        : dataset(nullptr), ownsDataset(true), maskOrigin(MaskOrigin::None), maskBandIndex(-1), maskBand(nullptr),
+          maskPixels(nullptr), maskLineStride(0), maskScanned(false), options(opts), logStream(&cout), silentLog(nullptr), hasGeoTransform(false) {
+        if (!logEnabled(Verbosity::Normal)) {
+            silenceLog();
+        }
+        registerDrivers();
+    }
+    
+    ~RasterProcessor() {
+        // Отображение ссылается на файл набора и освобождается до закрытия
+        maskMapping.reset();
+        if (dataset && ownsDataset) {
+            GDALClose(dataset);
+        }
+    }
+    
+    // Поток для сообщений о ходе обработки (по умолчанию cout на уровне Normal)
+    void setLog(ostream& stream) {
+        logStream = &stream;
+    }
+    
+    void silenceLog() {
+        logStream = &silentLog;
+    }
+    
+    bool loadRaster(const string& filename) {
+        return openRaster(filename) && loadMaskData();
+    }
+    
+    bool loadDataset(GDALDataset* ds, const string& name) {
+        return attachDataset(ds, name) && loadMaskData();
+    }
+    
+    // Только метаданные: размеры, геотрансформация, CRS; пиксели не читаются.
+    // Для COG по сети это заголовок и IFD, без тайлов.
+    bool openRaster(const string& filename) {
+        StageTimer timer(Stage::Open);
+        string path = gdalPath(filename);
+        dataset = (GDALDataset*)GDALOpen(path.c_str(), GA_ReadOnly);
+        if (!dataset) {
+            cerr << "Не удалось открыть файл: " << filename << endl;
+            return false;
+        }
+        ownsDataset = true;
+        sourceName = path;
+        readMetadata();
+        
+        *logStream << "Загружен: " << filename << " (" << width << "x" << height << ")" << '\n';
+        return true;
+    }
+    
+    // Уже открытый набор (в т.ч. MEM, /vsimem/); вызывающий закрывает его
+    // сам после разрушения процессора
+    bool attachDataset(GDALDataset* ds, const string& name) {
+        if (!ds) {
+            return false;
+        }
+        dataset = ds;
+        ownsDataset = false;
+        sourceName = name;
+        readMetadata();
+        return true;
+    }
+    
+    // Вторая фаза двухфазного режима: границы непрозрачных данных только
+    // внутри окна, читаются лишь блоки маски, пересекающие его. Число
+    // пикселей не считается (hasCounts = false), маска в памяти не хранится.
+    bool loadMaskWindow(const PixelWindow& window) {
+        StageTimer timer(Stage::Scan);
+        GDALRasterBand* band = resolveMaskBand(dataset, maskOrigin, maskBandIndex);
+        maskBand = band;
+        
+        if (maskOrigin == MaskOrigin::AllValid) {
+            // Все пиксели валидны: границы - само окно
+            maskStats.reset(0);
+            maskStats.hasCounts = false;
+            if (!window.empty()) {
+                maskStats.foundData = true;
+                maskStats.minX = window.xOff;
+                maskStats.minY = window.yOff;
+                maskStats.maxX = window.xEnd() - 1;
+                maskStats.maxY = window.yEnd() - 1;
+            }
+            maskScanned = true;
+            return true;
+        }
+        if (!band) {
+            cerr << "Альфа-канал не найдена" << endl;
+            return false;
+        }
+        
+        *logStream << "Чтение маски в окне [" << window.xOff << "," << window.yOff << "] "
+             << window.xSize << "x" << window.ySize << " из " << width << "x" << height << '\n';
+        BandTileSource source(band);
+        maskScanned = findBoundsEdgeInward(source, window, maskStats);
+        return maskScanned;
+    }
+    
+    #ifdef HAS_GEOS
+    GeosGeometryPtr getValidGeometry() {
+        if (!maskScanned) {
+            return nullptr;
+        }
+        
+        *logStream << "Создание геометрии из маски..." << '\n';
+        
+        // Границы непрозрачных данных посчитаны при загрузке
+        int dataMinX = maskStats.minX, dataMinY = maskStats.minY;
+        int dataMaxX = maskStats.maxX, dataMaxY = maskStats.maxY;
+        
+        if (!maskStats.foundData) {
+            *logStream << "Непрозрачные данные не найдены" << '\n';
+            return nullptr;
+        }
+        
+        // Отрезки строятся не на всех путях загрузки (GMF_ALL_VALID, --overviews),
+        // поэтому проверяется, что они есть для каждой строки
+        if (options.footprint == FootprintMode::Polygon && maskSpans.rowOffsets.size() == (size_t)height + 1) {
+            return polygonizeSpans();
+        }
+        if (options.footprint == FootprintMode::Polygon && maskBand) {
+            return polygonizeFootprint();
+        }
+        
+        *logStream << "Границы данных: [" << dataMinX << "," << dataMinY << "] - [" 
+             << dataMaxX << "," << dataMaxY << "]" << '\n';
+        
+        // Углы переводятся по отдельности: у повернутого растра
+        // прямоугольник пикселей в координатах - параллелограмм
+        return pixelRectToGEOS(dataMinX, dataMinY, dataMaxX + 1, dataMaxY + 1);
+    }
+    
+    // Реальный контур непрозрачной области: GDALPolygonize по каналу маски
+    // во временный слой в памяти, из которого берутся только полигоны со
+    // значением 255. Дыры сохраняются, при simplifyTolerance > 0 контур
+    // упрощается с сохранением топологии.
+    GeosGeometryPtr polygonizeFootprint() {
+        *logStream << "Векторизация контура маски..." << '\n';
+        
+        GDALDriver* memDriver = GetGDALDriverManager()->GetDriverByName("Memory");
+        if (!memDriver) {
+            memDriver = GetGDALDriverManager()->GetDriverByName("MEM");
+        }
+        if (!memDriver) {
+            cerr << "Драйвер Memory недоступен" << endl;
+            return nullptr;
+        }
+        
+        GDALDataset* vectorDs = memDriver->Create("footprint", 0, 0, 0, GDT_Unknown, nullptr);
+        if (!vectorDs) {
+            return nullptr;
+        }
+        
+        OGRLayer* layer = vectorDs->CreateLayer("footprint", nullptr, wkbPolygon, nullptr);
+        OGRFieldDefn valueField("DN", OFTInteger);
+        if (!layer || layer->CreateField(&valueField) != OGRERR_NONE) {
+            GDALClose(vectorDs);
+            return nullptr;
+        }
+        
+        // Маска используется и как фильтр: нулевые пиксели не векторизуются
+        CPLErr err = GDALPolygonize(maskBand, maskBand, layer, 0, nullptr, nullptr, nullptr);
+        if (err != CE_None) {
+            cerr << "Ошибка GDALPolygonize" << endl;
+            GDALClose(vectorDs);
+            return nullptr;
+        }
+        
+        // GDALPolygonize применяет геотрансформацию набора, которому
+        // принадлежит канал; без нее координаты остаются пиксельными
+        double bandTransform[6];
+        GDALDataset* bandDs = maskBand->GetDataset();
+        bool pixelCoords = !bandDs || bandDs->GetGeoTransform(bandTransform) != CE_None;
+        
+        vector<GeosGeometryPtr> parts;
+        layer->ResetReading();
+        OGRFeature* feature;
+        while ((feature = layer->GetNextFeature()) != nullptr) {
+            OGRGeometry* geom = feature->GetGeometryRef();
+            if (feature->GetFieldAsInteger(0) == 255 && geom &&
+                wkbFlatten(geom->getGeometryType()) == wkbPolygon) {
+                GeosGeometryPtr part = ogrPolygonToGEOS(static_cast<OGRPolygon*>(geom), pixelCoords);
+                if (part) parts.push_back(move(part));
+            }
+            OGRFeature::DestroyFeature(feature);
+        }
+        GDALClose(vectorDs);
+        
+        if (parts.empty()) {
+            *logStream << "Непрозрачные данные не найдены" << '\n';
+            return nullptr;
+        }
+        
+        // Полигоны одного значения не пересекаются, поэтому мультиполигон валиден без объединения
+        size_t partCount = parts.size();
+        GeosGeometryPtr footprint = partCount == 1
+            ? move(parts[0])
+            : makeCollection(GEOS_MULTIPOLYGON, move(parts));
+        
+        footprint = simplifyFootprint(move(footprint));
+        if (footprint) {
+            *logStream << "Контур: полигонов " << partCount
+                 << ", вершин " << GEOSGetNumCoordinates_r(geosContext(), footprint.get()) << '\n';
+        }
+        return footprint;
+    }
+    
+    // Контур прямо по отрезкам: одинаковые отрезки соседних строк сливаются
+    // в прямоугольники, которые затем объединяются (GEOSUnaryUnion)
+    GeosGeometryPtr polygonizeSpans() {
+        *logStream << "Векторизация контура по отрезкам..." << '\n';
+        
+        struct OpenRect {
+            MaskSpan span;
+            int y0;
+        };
+        vector<GeosGeometryPtr> rects;
+        vector<OpenRect> open, next;
+        
+        auto closeRect = [&](const OpenRect& rect, int y1) {
+            rects.push_back(pixelRectToGEOS(rect.span.start, rect.y0, rect.span.end, y1));
+        };
+        
+        for (int y = 0; y <= height; ++y) {
+            next.clear();
+            size_t b = y < height ? maskSpans.rowBegin(y) : 0;
+            size_t e = y < height ? maskSpans.rowEnd(y) : 0;
+            size_t j = 0;
+            for (size_t i = b; i < e; ++i) {
+                const MaskSpan& span = maskSpans.spans[i];
+                // Открытые прямоугольники левее текущего отрезка закрываются
+                while (j < open.size() && open[j].span.start < span.start) {
+                    closeRect(open[j++], y);
+                }
+                if (j < open.size() && open[j].span.start == span.start && open[j].span.end == span.end) {
+                    next.push_back(open[j++]);
+                } else {
+                    if (j < open.size() && open[j].span.start == span.start) {
+                        closeRect(open[j++], y);
+                    }
+                    next.push_back({span, y});
+                }
+            }
+            while (j < open.size()) {
+                closeRect(open[j++], y);
+            }
+            open.swap(next);
+        }
+        
+        if (rects.empty()) {
+            return nullptr;
+        }
+        
+        size_t rectCount = rects.size();
+        GeosGeometryPtr collection = makeCollection(GEOS_MULTIPOLYGON, move(rects));
+        if (!collection) {
+            return nullptr;
+        }
+        GeosGeometryPtr footprint(GEOSUnaryUnion_r(geosContext(), collection.get()));
+        
+        footprint = simplifyFootprint(move(footprint));
+        if (footprint) {
+            *logStream << "Контур: прямоугольников " << rectCount
+                 << ", вершин " << GEOSGetNumCoordinates_r(geosContext(), footprint.get()) << '\n';
+        }
+        return footprint;
+    }
+    
+    // Упрощение контура с сохранением топологии при simplifyTolerance > 0
+    GeosGeometryPtr simplifyFootprint(GeosGeometryPtr footprint) {
+        if (!footprint || options.simplifyTolerance <= 0) {
+            return footprint;
+        }
+        GeosGeometryPtr simplified(GEOSTopologyPreserveSimplify_r(geosContext(), footprint.get(),
+                                                                  options.simplifyTolerance));
+        return simplified ? move(simplified) : move(footprint);
+    }
+    
+    // Прямоугольник пикселей [x0, x1) x [y0, y1) в географических координатах.
+    // Обход против часовой стрелки: у геотрансформации с отрицательным
+    // определителем (север сверху) и без геотрансформации (pixelToGeo
+    // отражает y) порядок пикселей обратный.
+    GeosGeometryPtr pixelRectToGEOS(int x0, int y0, int x1, int y1) {
+        GEOSContextHandle_t ctx = geosContext();
+        bool flipped = !hasGeoTransform || geoTransform[1] * geoTransform[5] - geoTransform[2] * geoTransform[4] < 0;
+        if (flipped) {
+            swap(y0, y1);
+        }
+        const double px[5] = {(double)x0, (double)x1, (double)x1, (double)x0, (double)x0};
+        const double py[5] = {(double)y0, (double)y0, (double)y1, (double)y1, (double)y0};
+        GeosCoordSeqPtr coordSeq(GEOSCoordSeq_create_r(ctx, 5, 2));
+        for (unsigned i = 0; i < 5; ++i) {
+            double gx, gy;
+            pixelToGeo(px[i], py[i], gx, gy);
+            GEOSCoordSeq_setX_r(ctx, coordSeq.get(), i, gx);
+            GEOSCoordSeq_setY_r(ctx, coordSeq.get(), i, gy);
+        }
+        return makePolygon(makeLinearRing(move(coordSeq)));
+    }
+    
+    GeosGeometryPtr ogrRingToGEOS(const OGRLinearRing* ring, bool pixelCoords) {
+        GEOSContextHandle_t ctx = geosContext();
+        int count = ring->getNumPoints();
+        GeosCoordSeqPtr coordSeq(GEOSCoordSeq_create_r(ctx, count, 2));
+        for (int i = 0; i < count; ++i) {
+            double x = ring->getX(i), y = ring->getY(i);
+            if (pixelCoords) {
+                pixelToGeo(x, y, x, y);
+            }
+            GEOSCoordSeq_setX_r(ctx, coordSeq.get(), i, x);
+            GEOSCoordSeq_setY_r(ctx, coordSeq.get(), i, y);
+        }
+        return makeLinearRing(move(coordSeq));
+    }
+    
+    GeosGeometryPtr ogrPolygonToGEOS(const OGRPolygon* polygon, bool pixelCoords) {
+        const OGRLinearRing* exterior = polygon->getExteriorRing();
+        if (!exterior || exterior->getNumPoints() < 4) {
+            return nullptr;
+        }
+        
+        GeosGeometryPtr shell = ogrRingToGEOS(exterior, pixelCoords);
+        vector<GeosGeometryPtr> holes;
+        for (int i = 0; i < polygon->getNumInteriorRings(); ++i) {
+            const OGRLinearRing* interior = polygon->getInteriorRing(i);
+            if (interior && interior->getNumPoints() >= 4) {
+                holes.push_back(ogrRingToGEOS(interior, pixelCoords));
+            }
+        }
+        return makePolygon(move(shell), move(holes));
+    }
+    #endif
+    
+    void printDetailedInfo() {
+        if (!dataset) return;
+        
+        *logStream << "\nДетальная информация о растре:" << '\n';
+        *logStream << "Размер: " << width << "x" << height << '\n';
+        *logStream << "Каналы: " << dataset->GetRasterCount() << '\n';
+        
+        for (int i = 1; i <= dataset->GetRasterCount(); ++i) {
+            GDALRasterBand* band = dataset->GetRasterBand(i);
+            GDALColorInterp colorType = band->GetColorInterpretation();
+            const char* colorName = GDALGetColorInterpretationName(colorType);
+            *logStream << "  Канал " << i << ": " << colorName << '\n';
+        }
+        
+        // Статистика по маске посчитана при загрузке
+        if (maskStats.hasCounts) {
+            long long opaqueCount = maskStats.opaqueCount;
+            
+            *logStream << "Непрозрачных пикселей: " << opaqueCount 
+                 << " (" << (opaqueCount * 100.0 / ((double)width * height)) << "%)" << '\n';
+        } else {
+            *logStream << "Непрозрачных пикселей: не вычислялось (режим только границ)" << '\n';
+        }
+        
+        // Информация о геотрансформации
+        if (hasGeoTransform) {
+            *logStream << "Геотрансформация: [" << geoTransform[0] << ", " << geoTransform[1] 
+                 << ", " << geoTransform[2] << ", " << geoTransform[3] 
+                 << ", " << geoTransform[4] << ", " << geoTransform[5] << "]" << '\n';
+        } else {
+            *logStream << "Геотрансформация не найдена" << '\n';
+        }
+        
+        if (!spatialRefWkt.empty()) {
+            *logStream << "Система координат: " << dataset->GetSpatialRef()->GetName() << '\n';
+        } else {
+            *logStream << "Система координат не задана" << '\n';
+        }
+    }
+    
+    const string& getSpatialRefWkt() const {
+        return spatialRefWkt;
+    }
+    
+    const MaskStats& getMaskStats() const {
+        return maskStats;
+    }
+    
+    const BitMask& getBitMask() const {
+        return maskBits;
+    }
+    
+    // Валидная область как прямоугольник со сторонами по осям. false, если
+    // она не прямоугольная (--footprint), растр повернут или данных нет -
+    // тогда нужна геометрия GEOS.
+    bool getValidBox(GeoBox& box) {
+        if (!maskScanned || !maskStats.foundData || options.footprint == FootprintMode::Polygon || isRotated()) {
+            return false;
+        }
+        
+        box = getDataBox();
+        *logStream << "Границы данных: [" << maskStats.minX << "," << maskStats.minY << "] - ["
+             << maskStats.maxX << "," << maskStats.maxY << "]" << '\n';
+        *logStream << "Географические границы: [" << box.minX << "," << box.minY << "] - ["
+             << box.maxX << "," << box.maxY << "]" << '\n';
+        return true;
+    }
+    
+    // Охват прямоугольника непрозрачных пикселей; для повернутого растра -
+    // охват его образа
+    GeoBox getDataBox() {
+        if (!maskStats.foundData) {
+            return GeoBox();
+        }
+        return pixelRectBox(maskStats.minX, maskStats.minY, maskStats.maxX + 1, maskStats.maxY + 1);
+    }
+    
+    // Охват всего растра по геотрансформации, без чтения пикселей
+    GeoBox getRasterBox() {
+        return pixelRectBox(0, 0, width, height);
+    }
+    
+    // Окно пикселей, покрывающее прямоугольник в координатах растра
+    PixelWindow geoBoxToWindow(const GeoBox& box) {
+        const double eps = 1e-9;
+        const double gx[4] = {box.minX, box.maxX, box.maxX, box.minX};
+        const double gy[4] = {box.minY, box.minY, box.maxY, box.maxY};
+        double minPx = 0, minPy = 0, maxPx = 0, maxPy = 0;
+        for (int i = 0; i < 4; ++i) {
+            double x, y;
+            geoToPixel(gx[i], gy[i], x, y);
+            minPx = i == 0 ? x : min(minPx, x);
+            minPy = i == 0 ? y : min(minPy, y);
+            maxPx = i == 0 ? x : max(maxPx, x);
+            maxPy = i == 0 ? y : max(maxPy, y);
+        }
+        
+        PixelWindow window;
+        window.xOff = (int)max(0.0, floor(minPx + eps));
+        window.yOff = (int)max(0.0, floor(minPy + eps));
+        window.xSize = (int)min((double)width, ceil(maxPx - eps)) - window.xOff;
+        window.ySize = (int)min((double)height, ceil(maxPy - eps)) - window.yOff;
+        if (window.empty()) {
+            window.xSize = window.ySize = 0;
+        }
+        return window;
+    }
+    
+    // Охват образа прямоугольника пикселей [x0, x1) x [y0, y1)
+    GeoBox pixelRectBox(int x0, int y0, int x1, int y1) {
+        GeoBox box;
+        const double px[4] = {(double)x0, (double)x1, (double)x1, (double)x0};
+        const double py[4] = {(double)y0, (double)y0, (double)y1, (double)y1};
+        for (int i = 0; i < 4; ++i) {
+            double gx, gy;
+            pixelToGeo(px[i], py[i], gx, gy);
+            box.minX = i == 0 ? gx : min(box.minX, gx);
+            box.minY = i == 0 ? gy : min(box.minY, gy);
+            box.maxX = i == 0 ? gx : max(box.maxX, gx);
+            box.maxY = i == 0 ? gy : max(box.maxY, gy);
+        }
+        return box;
+    }
+    
+    // Значения маски (255 - непрозрачно) в окне растра; читаются только пиксели окна
+    bool readMaskWindow(const PixelWindow& window, vector<uint8_t>& buffer) {
+        buffer.assign(window.empty() ? 0 : (size_t)window.xSize * window.ySize, 0);
+        if (window.empty()) {
+            return true;
+        }
+        if (maskOrigin == MaskOrigin::AllValid) {
+            fill(buffer.begin(), buffer.end(), (uint8_t)255);
+            return true;
+        }
+        if (!maskBand) {
+            return false;
+        }
+        return readBandWindow(maskBand, window.xOff, window.yOff, window.xSize, window.ySize,
+                              buffer.data(), window.xSize, window.ySize, 0, 0) == CE_None;
+    }
+    
+    // Геотрансформация растра с сеткой по осям; false - повернут или без привязки
+    bool getAxisAlignedTransform(double transform[6]) const {
+        if (!hasGeoTransform || isRotated()) {
+            return false;
+        }
+        copy(geoTransform, geoTransform + 6, transform);
+        return true;
+    }
+    
+    int getWidth() const {
+        return width;
+    }
+    
+    int getHeight() const {
+        return height;
+    }
+    
+    // Растры на одной сетке: одинаковые размеры и геотрансформация
+    bool sharesGridWith(const RasterProcessor& other) const {
+        if (width != other.width || height != other.height ||
+            hasGeoTransform != other.hasGeoTransform) {
+            return false;
+        }
+        for (int i = 0; hasGeoTransform && i < 6; ++i) {
+            if (geoTransform[i] != other.geoTransform[i]) return false;
+        }
+        return true;
+    }
+    
+    // Сдвиг сетки other относительно этой в целых пикселях: пиксель (0, 0)
+    // other совпадает с пикселем (dx, dy) этого растра. false - сетки
+    // несовместимы: поворот, нет привязки, другой размер пикселя или
+    // дробный сдвиг начала. Допуск - миллионная доля пикселя на всю
+    // ширину растра: размер пикселя в метаданных записан с округлением.
+    bool gridOffsetTo(const RasterProcessor& other, int& dx, int& dy) const {
+        if (!hasGeoTransform || !other.hasGeoTransform || isRotated() || other.isRotated()) {
+            return false;
+        }
+        const double tolerance = 1e-6;
+        const double* t = geoTransform;
+        const double* u = other.geoTransform;
+        if (fabs(u[1] - t[1]) * max(width, other.width) > tolerance * fabs(t[1]) ||
+            fabs(u[5] - t[5]) * max(height, other.height) > tolerance * fabs(t[5])) {
+            return false;
+        }
+        double offsetX = (u[0] - t[0]) / t[1], offsetY = (u[3] - t[3]) / t[5];
+        double roundX = round(offsetX), roundY = round(offsetY);
+        if (fabs(offsetX - roundX) > tolerance || fabs(offsetY - roundY) > tolerance ||
+            fabs(roundX) > 1e9 || fabs(roundY) > 1e9) {
+            return false;
+        }
+        dx = (int)roundX;
+        dy = (int)roundY;
+        return true;
+    }
+    
+    // Площадь пикселя в единицах CRS
+    double pixelArea() const {
+        return hasGeoTransform ? fabs(geoTransform[1] * geoTransform[5] - geoTransform[2] * geoTransform[4]) : 1.0;
+    }
+    
+private:
+    bool loadMaskData() {
+        StageTimer timer(Stage::Scan);
+        GDALRasterBand* band = resolveMaskBand(dataset, maskOrigin, maskBandIndex);
+        maskBand = band;
+        maskSpans = MaskSpans();
+        
+        if (maskOrigin == MaskOrigin::AllValid) {
+            *logStream << "Маска: все пиксели валидны (GMF_ALL_VALID), чтение не требуется" << '\n';
+            fillAllValid();
+            maskScanned = true;
+            return true;
+        }
+        if (!band) {
+            cerr << "Альфа-канал не найдена" << endl;
+            return false;
+        }
+        
+        if (maskOrigin == MaskOrigin::AlphaBand) {
+            *logStream << "Загрузка альфа-канала (канал " << maskBandIndex << ")..." << '\n';
+        } else {
+            *logStream << "Загрузка маски набора данных ("
+                 << describeMaskFlags(dataset->GetRasterBand(maskBandIndex)->GetMaskFlags())
+                 << ")..." << '\n';
+        }
+        
+        if (options.useOverviews && band->GetOverviewCount() > 0) {
+            maskScanned = findBoundsCoarseToFine(band);
+            return maskScanned;
+        }
+        
+        if (options.storage == MaskStorage::Spans) {
+            maskScanned = buildMaskSpans(band);
+            return maskScanned;
+        }
+        
+        if (options.storage == MaskStorage::Bits) {
+            maskScanned = buildBitMask(band);
+            return maskScanned;
+        }
+        
+        if (options.storage == MaskStorage::Streaming) {
+            if (options.scanMode == MaskScanMode::BoundsOnly) {
+                BandTileSource source(band);
+                maskScanned = findBoundsEdgeInward(source, fullWindow(), maskStats);
+            } else {
+                maskScanned = scanMaskBlocks(band);
+            }
+            return maskScanned;
+        }
+        
+        if (options.mapMask) {
+            maskMapping = mapBand(band, maskPixels, maskLineStride);
+        }
+        if (maskMapping) {
+            *logStream << "Маска отображена в память без копирования (GetVirtualMemAuto)" << '\n';
+        } else {
+            maskData.resize((size_t)width * height);
+            
+            CPLErr err = readBandWindow(band, 0, 0, width, height,
+                                        maskData.data(), width, height, 0, 0);
+            if (err != CE_None) {
+                return false;
+            }
+            maskPixels = maskData.data();
+            maskLineStride = width;
+        }
+        
+        if (options.scanMode == MaskScanMode::BoundsOnly) {
+            DenseTileSource source(maskPixels, width, height, maskLineStride);
+            maskScanned = findBoundsEdgeInward(source, fullWindow(), maskStats);
+        } else {
+            scanDenseMask();
+            maskScanned = true;
+        }
+        return maskScanned;
+    }
+    
+    PixelWindow fullWindow() const {
+        PixelWindow window;
+        window.xSize = width;
+        window.ySize = height;
+        return window;
+    }
+    
+    // Поиск границ от грубого к точному. Приблизительный охват берется с
+    // самого маленького обзора канала, затем на полном разрешении читаются
+    // только блоки вдоль краев этого охвата (findBoundsEdgeInward в окне).
+    // Кандидатом на обзоре считается любой пиксель с ненулевой альфой, а окно
+    // расширяется на одну ячейку обзора, чтобы усреднение на краях не сузило
+    // охват. Данные, потерянные при построении обзора (отдельные пиксели
+    // меньше ячейки), могут лежать и вне окна, поэтому затем полосы между
+    // окном и краями растра проверяются тем же поиском от краев внутрь:
+    // окно и четыре полосы покрывают растр, и объединение их границ точное.
+    bool findBoundsCoarseToFine(GDALRasterBand* band) {
+        GDALRasterBand* coarse = nullptr;
+        for (int i = 0; i < band->GetOverviewCount(); ++i) {
+            GDALRasterBand* overview = band->GetOverview(i);
+            if (overview && (!coarse || overview->GetXSize() < coarse->GetXSize())) {
+                coarse = overview;
+            }
+        }
+        if (!coarse) {
+            BandTileSource source(band);
+            return findBoundsEdgeInward(source, fullWindow(), maskStats);
+        }
+        
+        int ovWidth = coarse->GetXSize(), ovHeight = coarse->GetYSize();
+        *logStream << "Грубый поиск по обзору " << ovWidth << "x" << ovHeight << '\n';
+        
+        vector<uint8_t> overviewData((size_t)ovWidth * ovHeight);
+        if (readBandWindow(coarse, 0, 0, ovWidth, ovHeight, overviewData.data(),
+                           ovWidth, ovHeight, 0, 0) != CE_None) {
+            return false;
+        }
+        
+        int cMinX = ovWidth, cMinY = ovHeight, cMaxX = -1, cMaxY = -1;
+        for (int y = 0; y < ovHeight; ++y) {
+            const uint8_t* line = &overviewData[(size_t)y * ovWidth];
+            for (int x = 0; x < ovWidth; ++x) {
+                if (line[x] != 0) {
+                    cMinX = min(cMinX, x);
+                    cMaxX = max(cMaxX, x);
+                    cMinY = min(cMinY, y);
+                    cMaxY = max(cMaxY, y);
+                }
+            }
+        }
+        
+        BandTileSource source(band);
+        if (cMaxX < 0) {
+            // На обзоре данных нет - проверяем полное разрешение целиком
+            return findBoundsEdgeInward(source, fullWindow(), maskStats);
+        }
+        
+        double scaleX = (double)width / ovWidth, scaleY = (double)height / ovHeight;
+        int x0 = max(0, (int)floor((cMinX - 1) * scaleX));
+        int y0 = max(0, (int)floor((cMinY - 1) * scaleY));
+        int x1 = min(width, (int)ceil((cMaxX + 2) * scaleX));
+        int y1 = min(height, (int)ceil((cMaxY + 2) * scaleY));
+        
+        // Окно охвата с обзора, затем полосы над ним, под ним, слева и справа
+        const int windows[5][4] = {
+            {x0, y0, x1, y1},
+            {0, 0, width, y0},
+            {0, y1, width, height},
+            {0, y0, x0, y1},
+            {x1, y0, width, y1},
+        };
+        maskStats.reset(0);
+        maskStats.hasCounts = false;
+        for (const auto& bounds : windows) {
+            PixelWindow window;
+            window.xOff = bounds[0];
+            window.yOff = bounds[1];
+            window.xSize = bounds[2] - bounds[0];
+            window.ySize = bounds[3] - bounds[1];
+            
+            MaskStats stats;
+            if (!findBoundsEdgeInward(source, window, stats)) {
+                return false;
+            }
+            maskStats.merge(stats);
+        }
+        return true;
+    }
+    
+    // Единственный проход по плотной маске: границы, количество и гистограмма по строкам.
+    // Маска делится на полосы строк, которые разбирают потоки планировщика.
+    void scanDenseMask() {
+        const int bandRows = 256;
+        int tileCount = (height + bandRows - 1) / bandRows;
+        
+        TileScheduler scheduler(options.threads);
+        vector<MaskStats> partial(scheduler.size());
+        for (MaskStats& stats : partial) {
+            stats.reset(height);
+        }
+        
+        scheduler.run(tileCount, [&](int tile, int worker) {
+            MaskStats& stats = partial[worker];
+            int yEnd = min(height, (tile + 1) * bandRows);
+            for (int y = tile * bandRows; y < yEnd; ++y) {
+                int first, last;
+                int count = scanLine(maskPixels + (size_t)y * maskLineStride, width, first, last);
+                stats.addRow(y, first, last, count);
+            }
+        });
+        
+        maskStats.reset(height);
+        for (const MaskStats& stats : partial) {
+            maskStats.merge(stats);
+        }
+    }
+    
+    // Поблочный обход канала в его естественном размере блока.
+    // Границы и статистика считаются по ходу, maskData не заполняется.
+    // Блоки разбирают потоки планировщика; каждый поток читает через
+    // собственный GDALDataset, так как один дескриптор не потокобезопасен.
+    bool scanMaskBlocks(GDALRasterBand* band) {
+        int blockXSize = 0, blockYSize = 0;
+        band->GetBlockSize(&blockXSize, &blockYSize);
+        if (blockXSize <= 0 || blockYSize <= 0) {
+            cerr << "Некорректный размер блока: " << blockXSize << "x" << blockYSize << endl;
+            return false;
+        }
+        
+        int blocksX = (width + blockXSize - 1) / blockXSize;
+        int blocksY = (height + blockYSize - 1) / blockYSize;
+        
+        TileScheduler scheduler(readerThreads());
+        int threadCount = scheduler.size();
+        
+        *logStream << "Поблочное чтение: блок " << blockXSize << "x" << blockYSize
+             << ", блоков " << blocksX << "x" << blocksY
+             << ", потоков " << threadCount << '\n';
+        
+        vector<MaskStats> partial(threadCount);
+        WorkerSources workers(threadCount);
+        atomic<bool> failed(false);
+        for (MaskStats& stats : partial) {
+            stats.reset(height);
+        }
+        
+        scheduler.run(blocksX * blocksY, [&](int tile, int worker) {
+            if (failed) return;
+            
+            BandTileSource* source = workerSource(workers, worker, band);
+            if (!source || !scanTile(*source, tile % blocksX, tile / blocksX, partial[worker])) {
+                failed = true;
+            }
+        });
+        
+        if (failed) {
+            return false;
+        }
+        
+        maskStats.reset(height);
+        for (const MaskStats& stats : partial) {
+            maskStats.merge(stats);
+        }
+        return true;
+    }
+    
+    // Источники блоков для потоков планировщика: поток 0 читает через основной
+    // дескриптор, остальные открывают набор заново, так как один GDALDataset
+    // нельзя читать из нескольких потоков
+    struct WorkerSources {
+        vector<unique_ptr<BandTileSource>> sources;
+        vector<GDALDataset*> handles;
+        
+        explicit WorkerSources(int count) : sources(count), handles(count, nullptr) {}
+        
+        ~WorkerSources() {
+            sources.clear();
+            for (GDALDataset* handle : handles) {
+                if (handle) GDALClose(handle);
+            }
+        }
+    };
+    
+    // Потоки чтения канала. Переданный вызывающим набор (attachDataset) нельзя
+    // открыть заново по имени - у MEM и других наборов в памяти его нет, - поэтому
+    // он читается в одном потоке через основной дескриптор
+    int readerThreads() const {
+        return ownsDataset ? options.threads : 1;
+    }
+    
+    BandTileSource* workerSource(WorkerSources& workers, int worker, GDALRasterBand* band) {
+        if (!workers.sources[worker]) {
+            GDALRasterBand* workerBand = band;
+            if (worker > 0) {
+                workers.handles[worker] = (GDALDataset*)GDALOpen(sourceName.c_str(), GA_ReadOnly);
+                if (!workers.handles[worker]) {
+                    return nullptr;
+                }
+                MaskOrigin origin;
+                int bandIndex;
+                workerBand = resolveMaskBand(workers.handles[worker], origin, bandIndex);
+                if (!workerBand) {
+                    return nullptr;
+                }
+            }
+            workers.sources[worker].reset(new BandTileSource(workerBand));
+        }
+        return workers.sources[worker].get();
+    }
+    
+    // Построение отрезков при поблочном чтении. Задача планировщика - полоса
+    // блоков на всю ширину: блоки полосы читаются слева направо, отрезки
+    // каждой строки склеиваются на границах блоков. Полосы затем сшиваются по порядку.
+    bool buildMaskSpans(GDALRasterBand* band) {
+        int blockXSize = 0, blockYSize = 0;
+        band->GetBlockSize(&blockXSize, &blockYSize);
+        if (blockXSize <= 0 || blockYSize <= 0) {
+            cerr << "Некорректный размер блока: " << blockXSize << "x" << blockYSize << endl;
+            return false;
+        }
+        
+        int blocksX = (width + blockXSize - 1) / blockXSize;
+        int blocksY = (height + blockYSize - 1) / blockYSize;
+        
+        TileScheduler scheduler(readerThreads());
+        WorkerSources workers(scheduler.size());
+        atomic<bool> failed(false);
+        
+        // Для каждой полосы: отрезки строк полосы подряд и их границы
+        vector<vector<MaskSpan>> stripSpans(blocksY);
+        vector<vector<size_t>> stripRows(blocksY);
+        
+        scheduler.run(blocksY, [&](int by, int worker) {
+            if (failed) return;
+            BandTileSource* source = workerSource(workers, worker, band);
+            if (!source) {
+                failed = true;
+                return;
+            }
+            
+            int rows = min(blockYSize, height - by * blockYSize);
+            vector<vector<MaskSpan>> rowSpans(rows);
+            for (int bx = 0; bx < blocksX; ++bx) {
+                int validX, validY;
+                size_t stride;
+                const uint8_t* tile = source->readTile(bx, by, validX, validY, stride);
+                if (!tile) {
+                    failed = true;
+                    return;
+                }
+                for (int row = 0; row < validY; ++row) {
+                    appendLineSpans(tile + row * stride, validX, bx * blockXSize, rowSpans[row]);
+                }
+            }
+            
+            vector<MaskSpan>& spans = stripSpans[by];
+            vector<size_t>& offsets = stripRows[by];
+            for (const vector<MaskSpan>& row : rowSpans) {
+                offsets.push_back(spans.size());
+                spans.insert(spans.end(), row.begin(), row.end());
+            }
+            spans.shrink_to_fit();
+        });
+        
+        if (failed) {
+            return false;
+        }
+        
+        maskSpans = MaskSpans();
+        maskSpans.width = width;
+        maskSpans.height = height;
+        maskSpans.rowOffsets.reserve((size_t)height + 1);
+        for (int by = 0; by < blocksY; ++by) {
+            size_t base = maskSpans.spans.size();
+            for (size_t offset : stripRows[by]) {
+                maskSpans.rowOffsets.push_back(base + offset);
+            }
+            maskSpans.spans.insert(maskSpans.spans.end(), stripSpans[by].begin(), stripSpans[by].end());
+            vector<MaskSpan>().swap(stripSpans[by]);
+        }
+        maskSpans.rowOffsets.push_back(maskSpans.spans.size());
+        
+        *logStream << "Отрезков маски: " << maskSpans.spans.size()
+             << " (" << maskSpans.memoryBytes() << " байт вместо "
+             << (long long)width * height << ")" << '\n';
+        
+        // По отрезкам статистика почти бесплатна, поэтому считается всегда
+        maskStats = maskSpans.computeStats();
+        return true;
+    }
+    
+    // Заполнение битовой маски при поблочном чтении. Задача планировщика -
+    // полоса блоков на всю ширину, поэтому потоки пишут в разные строки
+    // и не делят слова на стыках блоков.
+    bool buildBitMask(GDALRasterBand* band) {
+        int blockXSize = 0, blockYSize = 0;
+        band->GetBlockSize(&blockXSize, &blockYSize);
+        if (blockXSize <= 0 || blockYSize <= 0) {
+            cerr << "Некорректный размер блока: " << blockXSize << "x" << blockYSize << endl;
+            return false;
+        }
+        
+        int blocksX = (width + blockXSize - 1) / blockXSize;
+        int blocksY = (height + blockYSize - 1) / blockYSize;
+        
+        maskBits.reset(width, height);
+        
+        TileScheduler scheduler(readerThreads());
+        WorkerSources workers(scheduler.size());
+        atomic<bool> failed(false);
+        
+        scheduler.run(blocksY, [&](int by, int worker) {
+            if (failed) return;
+            BandTileSource* source = workerSource(workers, worker, band);
+            if (!source) {
+                failed = true;
+                return;
+            }
+            for (int bx = 0; bx < blocksX; ++bx) {
+                int validX, validY;
+                size_t stride;
+                const uint8_t* tile = source->readTile(bx, by, validX, validY, stride);
+                if (!tile) {
+                    failed = true;
+                    return;
+                }
+                for (int row = 0; row < validY; ++row) {
+                    maskBits.packLine(by * blockYSize + row, bx * blockXSize, tile + row * stride, validX);
+                }
+            }
+        });
+        
+        if (failed) {
+            return false;
+        }
+        
+        *logStream << "Битовая маска: " << maskBits.memoryBytes() << " байт вместо "
+             << (long long)width * height << '\n';
+        
+        maskStats = maskBits.computeStats();
+        return true;
+    }
+    
+    // Читает тайл (tx, ty) и добавляет его строки в stats
+    static bool scanTile(MaskTileSource& source, int tx, int ty, MaskStats& stats) {
+        int validX, validY;
+        size_t stride;
+        const uint8_t* tile = source.readTile(tx, ty, validX, validY, stride);
+        if (!tile) {
+            return false;
+        }
+        
+        int x0 = tx * source.tileWidth(), y0 = ty * source.tileHeight();
+        for (int row = 0; row < validY; ++row) {
+            int first, last;
+            int count = scanLine(tile + row * stride, validX, first, last);
+            stats.addRow(y0 + row, x0 + first, x0 + last, count);
+        }
+        return true;
+    }
+    
+    // Полностью валидный растр: границы и статистика известны без чтения
+    void fillAllValid() {
+        maskStats.reset(height);
+        if (width <= 0 || height <= 0) {
+            return;
+        }
+        maskStats.foundData = true;
+        maskStats.minX = 0;
+        maskStats.minY = 0;
+        maskStats.maxX = width - 1;
+        maskStats.maxY = height - 1;
+        maskStats.opaqueCount = (long long)width * height;
+        fill(maskStats.rowCounts.begin(), maskStats.rowCounts.end(), (uint32_t)width);
+    }
+    
+    // Размеры, геотрансформация и CRS открытого набора
+    void readMetadata() {
+        width = dataset->GetRasterXSize();
+        height = dataset->GetRasterYSize();
+        hasGeoTransform = (dataset->GetGeoTransform(geoTransform) == CE_None);
+        
+        spatialRefWkt.clear();
+        const OGRSpatialReference* spatialRef = dataset->GetSpatialRef();
+        char* wkt = nullptr;
+        if (spatialRef && !spatialRef->IsEmpty() && spatialRef->exportToWkt(&wkt) == OGRERR_NONE && wkt) {
+            spatialRefWkt = wkt;
+        }
+        CPLFree(wkt);
+    }
+    
+    // Определяет канал маски набора ds, его происхождение и номер канала.
+    // Порядок: явный альфа-канал; маска GDAL (GetMaskBand), если флаги
+    // говорят, что она есть (маска набора, .msk, внутренняя маска, nodata);
+    // при GMF_ALL_VALID у четырехканального растра, как и раньше, альфой
+    // считается 4-й байтовый канал без интерпретации (RGBA без тега альфы),
+    // иначе весь растр валиден и канал не нужен (nullptr). Канал с заданной
+    // интерпретацией (например, ближний ИК у RGBI) альфой не считается.
+    static GDALRasterBand* resolveMaskBand(GDALDataset* ds, MaskOrigin& origin, int& bandIndex) {
+        int bandCount = ds->GetRasterCount();
+        
+        int alphaBand = findAlphaBand(ds);
+        if (alphaBand != -1) {
+            origin = MaskOrigin::AlphaBand;
+            bandIndex = alphaBand;
+            return ds->GetRasterBand(alphaBand);
+        }
+        
+        if (bandCount == 0) {
+            origin = MaskOrigin::None;
+            bandIndex = -1;
+            return nullptr;
+        }
+        
+        GDALRasterBand* firstBand = ds->GetRasterBand(1);
+        if (firstBand->GetMaskFlags() & GMF_ALL_VALID) {
+            GDALRasterBand* lastBand = ds->GetRasterBand(bandCount);
+            if (bandCount == 4 && lastBand->GetRasterDataType() == GDT_Byte &&
+                lastBand->GetColorInterpretation() == GCI_Undefined) {
+                origin = MaskOrigin::AlphaBand;
+                bandIndex = bandCount;
+                return lastBand;
+            }
+            if (bandCount >= 4) {
+                cerr << "Предупреждение: у растра " << bandCount << " каналов, но нет ни альфа-канала, "
+                     << "ни маски; весь растр считается валидным" << endl;
+            }
+            origin = MaskOrigin::AllValid;
+            bandIndex = -1;
+            return nullptr;
+        }
+        
+        origin = MaskOrigin::MaskBand;
+        bandIndex = 1;
+        return firstBand->GetMaskBand();
+    }
+    
+    static string describeMaskFlags(int flags) {
+        string result;
+        if (flags & GMF_PER_DATASET) result += "GMF_PER_DATASET ";
+        if (flags & GMF_ALPHA) result += "GMF_ALPHA ";
+        if (flags & GMF_NODATA) result += "GMF_NODATA ";
+        if (flags & GMF_ALL_VALID) result += "GMF_ALL_VALID ";
+        if (result.empty()) return "маска канала";
+        result.pop_back();
+        return result;
+    }
+    
+    static int findAlphaBand(GDALDataset* ds) {
+        int bandCount = ds->GetRasterCount();
+        
+        for (int i = 1; i <= bandCount; ++i) {
+            GDALRasterBand* band = ds->GetRasterBand(i);
+            GDALColorInterp colorInterp = band->GetColorInterpretation();
+            
+            if (colorInterp == GCI_AlphaBand) {
+                return i;
+            }
+        }
+        
+        return -1;
+    }
+    
+    bool isRotated() const {
+        return hasGeoTransform && (geoTransform[2] != 0.0 || geoTransform[4] != 0.0);
+    }
+    
+    void geoToPixel(double geoX, double geoY, double& x, double& y) {
+        double inverse[6];
+        if (hasGeoTransform && GDALInvGeoTransform(geoTransform, inverse)) {
+            x = inverse[0] + geoX * inverse[1] + geoY * inverse[2];
+            y = inverse[3] + geoX * inverse[4] + geoY * inverse[5];
+        } else {
+            x = geoX;
+            y = height - geoY;
+        }
+    }
+    
+    void pixelToGeo(double x, double y, double& geoX, double& geoY) {
+        if (hasGeoTransform) {
+            geoX = geoTransform[0] + x * geoTransform[1] + y * geoTransform[2];
+            geoY = geoTransform[3] + x * geoTransform[4] + y * geoTransform[5];
+        } else {
+            geoX = x;
+            geoY = height - y;
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Запись признаков результата. Признаки пишутся по одному, без построения
+// дерева документа: GeoJSON - потоком через переиспользуемый буфер,
+// FlatGeobuf и GeoPackage - через OGR. Схема атрибутов задается при
+// открытии и одинакова для всех признаков.
+// ---------------------------------------------------------------------------
+
+// Значение атрибута признака
+struct FeatureField {
+    string name;
+    bool numeric = false;
+    string text;
+    double number = 0.0;
+};
+
+// Геометрия признака: прямоугольник со сторонами по осям или геометрия GEOS
+struct FeatureGeometry {
+    const GeoBox* box = nullptr;
+    #ifdef HAS_GEOS
+    const GEOSGeometry* geometry = nullptr;
+    #endif
+};
+
+// Отбор признаков прежнего результата по атрибутам a и b
+using OverlapFilter = function<bool(const string& a, const string& b)>;
+
+class FeatureWriter {
+public:
+    virtual ~FeatureWriter() {}
+    
+    virtual bool open(const string& path, const string& crsWkt, const vector<FeatureField>& schema) = 0;
+    virtual bool write(const vector<FeatureField>& fields, const FeatureGeometry& geometry) = 0;
+    virtual bool close() = 0;
+    
+    // Переносит без пересчета признаки файла того же формата, для которых
+    // keep истинно; copied - их число. false - файл не прочитан.
+    virtual bool copyFrom(const string& path, const OverlapFilter& keep, size_t& copied) = 0;
+};
+
+// GeoJSON без DOM: признак собирается в буфер, который переиспользуется
+// между признаками, и сразу уходит в файл; по признаку на строку. Числа
+// пишутся кратчайшим точным представлением (to_chars).
+class GeoJSONWriter : public FeatureWriter {
+public:
+    bool open(const string& path, const string&, const vector<FeatureField>&) override {
+        out.open(path, ios::binary | ios::trunc);
+        if (!out) {
+            cerr << "Не удалось создать файл: " << path << endl;
+            return false;
+        }
+        out << collectionHeader << '\n';
+        first = true;
+        return true;
+    }
+    
+    bool write(const vector<FeatureField>& fields, const FeatureGeometry& geometry) override {
+        StageTimer timer(Stage::Serialize);
+        buffer.clear();
+        if (!first) {
+            buffer += ",\n";
+        }
+        first = false;
+        
+        buffer += "{\"type\": \"Feature\", \"properties\": {";
+        for (size_t i = 0; i < fields.size(); ++i) {
+            if (i) buffer += ", ";
+            appendString(fields[i].name);
+            buffer += ": ";
+            if (fields[i].numeric) {
+                appendNumber(fields[i].number);
+            } else {
+                appendString(fields[i].text);
+            }
+        }
+        buffer += "}, \"geometry\": ";
+        if (geometry.box) {
+            appendBox(*geometry.box);
+        }
+        #ifdef HAS_GEOS
+        else if (geometry.geometry) {
+            appendGeometry(geometry.geometry);
+        }
+        #endif
+        else {
+            buffer += "null";
+        }
+        buffer += "}";
+        
+        out.write(buffer.data(), (streamsize)buffer.size());
+        return (bool)out;
+    }
+    
+    bool close() override {
+        StageTimer timer(Stage::Serialize);
+        out << "\n]}\n";
+        out.close();
+        return !out.fail();
+    }
+    
+    // Файл этого писателя разбирается построчно (признак на строку) и
+    // переносится как есть; любой другой GeoJSON - документом целиком
+    bool copyFrom(const string& path, const OverlapFilter& keep, size_t& copied) override {
+        ifstream in(path, ios::binary);
+        if (!in) {
+            cerr << "Не удалось открыть прежний результат: " << path << endl;
+            return false;
+        }
+        
+        string line;
+        getline(in, line);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line != collectionHeader) {
+            in.clear();
+            in.seekg(0);
+            json document = json::parse(in, nullptr, false);
+            auto features = document.find("features");
+            if (document.is_discarded() || features == document.end() || !features->is_array()) {
+                cerr << "Прежний результат не является FeatureCollection: " << path << endl;
+                return false;
+            }
+            for (const json& feature : *features) {
+                if (keepFeature(feature, keep)) {
+                    writeRaw(feature.dump());
+                    copied++;
+                }
+            }
+            return (bool)out;
+        }
+        
+        while (getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty() && line.back() == ',') line.pop_back();
+            if (line.empty() || line == "]}") {
+                continue;
+            }
+            json feature = json::parse(line, nullptr, false);
+            if (feature.is_discarded()) {
+                cerr << "Поврежден прежний результат: " << path << endl;
+                return false;
+            }
+            if (keepFeature(feature, keep)) {
+                writeRaw(line);
+                copied++;
+            }
+        }
+        return (bool)out;
+    }
+    
+private:
+    static constexpr const char* collectionHeader = "{\"type\": \"FeatureCollection\", \"features\": [";
+    
+    ofstream out;
+    string buffer;
+    bool first = true;
+    
+    void writeRaw(const string& feature) {
+        if (!first) {
+            out << ",\n";
+        }
+        first = false;
+        out << feature;
+    }
+    
+    // Признак без атрибутов a и b (не пересечение пары) сохраняется
+    static bool keepFeature(const json& feature, const OverlapFilter& keep) {
+        auto properties = feature.find("properties");
+        if (properties == feature.end() || !properties->is_object()) {
+            return true;
+        }
+        return keep(properties->value("a", string()), properties->value("b", string()));
+    }
+    
+    void appendNumber(double value) {
+        if (!isfinite(value)) {
+            buffer += "null";
+            return;
+        }
+        char digits[32];
+        to_chars_result result = to_chars(digits, digits + sizeof(digits), value);
+        buffer.append(digits, result.ptr);
+    }
+    
+    void appendString(const string& value) {
+        buffer += '"';
+        for (unsigned char c : value) {
+            if (c == '"' || c == '\\') {
+                buffer += '\\';
+                buffer += (char)c;
+            } else if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                buffer += escaped;
+            } else {
+                buffer += (char)c;
+            }
+        }
+        buffer += '"';
+    }
+    
+    void appendPoint(double x, double y) {
+        buffer += '[';
+        appendNumber(x);
+        buffer += ", ";
+        appendNumber(y);
+        buffer += ']';
+    }
+    
+    // Внешнее кольцо против часовой стрелки, как требует RFC 7946
+    void appendBox(const GeoBox& box) {
+        buffer += "{\"type\": \"Polygon\", \"coordinates\": [[";
+        appendPoint(box.minX, box.minY);
+        buffer += ", ";
+        appendPoint(box.maxX, box.minY);
+        buffer += ", ";
+        appendPoint(box.maxX, box.maxY);
+        buffer += ", ";
+        appendPoint(box.minX, box.maxY);
+        buffer += ", ";
+        appendPoint(box.minX, box.minY);
+        buffer += "]]}";
+    }
+    
+    #ifdef HAS_GEOS
+    // reversed - точки в обратном порядке
+    void appendCoordSeq(const GEOSCoordSequence* coordSeq, bool reversed = false) {
+        GEOSContextHandle_t ctx = geosContext();
+        unsigned int size = 0;
+        buffer += '[';
+        if (coordSeq && GEOSCoordSeq_getSize_r(ctx, coordSeq, &size)) {
+            for (unsigned int i = 0; i < size; ++i) {
+                double x, y;
+                unsigned int index = reversed ? size - 1 - i : i;
+                GEOSCoordSeq_getX_r(ctx, coordSeq, index, &x);
+                GEOSCoordSeq_getY_r(ctx, coordSeq, index, &y);
+                if (i) buffer += ", ";
+                appendPoint(x, y);
+            }
+        }
+        buffer += ']';
+    }
+    
+    // Кольцо с обходом против часовой стрелки (ccw) или по ней
+    void appendRing(const GEOSGeometry* ring, bool ccw) {
+        GEOSContextHandle_t ctx = geosContext();
+        const GEOSCoordSequence* coordSeq = GEOSGeom_getCoordSeq_r(ctx, ring);
+        char isCCW = 0;
+        bool reversed = coordSeq && GEOSCoordSeq_isCCW_r(ctx, coordSeq, &isCCW) && (isCCW != 0) != ccw;
+        appendCoordSeq(coordSeq, reversed);
+    }
+    
+    // Обход колец по RFC 7946: внешнее против часовой стрелки, дыры - по ней,
+    // независимо от того, как их построили GEOS и GDALPolygonize
+    void appendPolygonRings(const GEOSGeometry* polygon) {
+        GEOSContextHandle_t ctx = geosContext();
+        buffer += '[';
+        appendRing(GEOSGetExteriorRing_r(ctx, polygon), true);
+        int holes = GEOSGetNumInteriorRings_r(ctx, polygon);
+        for (int i = 0; i < holes; ++i) {
+            buffer += ", ";
+            appendRing(GEOSGetInteriorRingN_r(ctx, polygon, i), false);
+        }
+        buffer += ']';
+    }
+    
+    void appendGeometry(const GEOSGeometry* geometry) {
+        GEOSContextHandle_t ctx = geosContext();
+        switch (GEOSGeomTypeId_r(ctx, geometry)) {
+            case GEOS_POINT: {
+                double x = 0.0, y = 0.0;
+                const GEOSCoordSequence* coordSeq = GEOSGeom_getCoordSeq_r(ctx, geometry);
+                GEOSCoordSeq_getX_r(ctx, coordSeq, 0, &x);
+                GEOSCoordSeq_getY_r(ctx, coordSeq, 0, &y);
+                buffer += "{\"type\": \"Point\", \"coordinates\": ";
+                appendPoint(x, y);
+                buffer += '}';
+                break;
+            }
+            case GEOS_LINESTRING:
+            case GEOS_LINEARRING:
+                buffer += "{\"type\": \"LineString\", \"coordinates\": ";
+                appendCoordSeq(GEOSGeom_getCoordSeq_r(ctx, geometry));
+                buffer += '}';
+                break;
+            case GEOS_POLYGON:
+                buffer += "{\"type\": \"Polygon\", \"coordinates\": ";
+                appendPolygonRings(geometry);
+                buffer += '}';
+                break;
+            case GEOS_MULTIPOLYGON:
+                buffer += "{\"type\": \"MultiPolygon\", \"coordinates\": [";
+                for (int i = 0; i < GEOSGetNumGeometries_r(ctx, geometry); ++i) {
+                    if (i) buffer += ", ";
+                    appendPolygonRings(GEOSGetGeometryN_r(ctx, geometry, i));
+                }
+                buffer += "]}";
+                break;
+            default:
+                buffer += "{\"type\": \"GeometryCollection\", \"geometries\": [";
+                for (int i = 0; i < GEOSGetNumGeometries_r(ctx, geometry); ++i) {
+                    if (i) buffer += ", ";
+                    appendGeometry(GEOSGetGeometryN_r(ctx, geometry, i));
+                }
+                buffer += "]}";
+                break;
+        }
+    }
+    #endif
+};
+
+// Векторный формат GDAL/OGR (FlatGeobuf, GPKG). Слой "overlaps" с CRS
+// результата; если драйвер поддерживает транзакции (GPKG), все признаки
+// пишутся в одной транзакции.
+class OgrFeatureWriter : public FeatureWriter {
+public:
+    explicit OgrFeatureWriter(const string& driverName) : driverName(driverName) {}
+    
+    ~OgrFeatureWriter() override {
+        if (dataset) {
+            GDALClose(dataset);
+        }
+    }
+    
+    bool open(const string& path, const string& crsWkt, const vector<FeatureField>& schema) override {
+        GDALDriver* driver = GetGDALDriverManager()->GetDriverByName(driverName.c_str());
+        if (!driver) {
+            cerr << "Драйвер " << driverName << " недоступен" << endl;
+            return false;
+        }
+        
+        // Драйверы OGR не перезаписывают существующий файл
+        error_code ec;
+        filesystem::remove(path, ec);
+        dataset = driver->Create(path.c_str(), 0, 0, 0, GDT_Unknown, nullptr);
+        if (!dataset) {
+            cerr << "Не удалось создать файл: " << path << endl;
+            return false;
+        }
+        
+        OGRSpatialReference srs;
+        const OGRSpatialReference* layerSrs = nullptr;
+        if (!crsWkt.empty() && srs.importFromWkt(crsWkt.c_str()) == OGRERR_NONE) {
+            srs.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+            layerSrs = &srs;
+        }
+        layer = dataset->CreateLayer("overlaps", layerSrs, wkbUnknown, nullptr);
+        if (!layer) {
+            return false;
+        }
+        for (const FeatureField& field : schema) {
+            OGRFieldDefn definition(field.name.c_str(), field.numeric ? OFTReal : OFTString);
+            if (layer->CreateField(&definition) != OGRERR_NONE) {
+                return false;
+            }
+        }
+        
+        inTransaction = dataset->StartTransaction() == OGRERR_NONE;
+        return true;
+    }
+    
+    bool write(const vector<FeatureField>& fields, const FeatureGeometry& geometry) override {
+        StageTimer timer(Stage::Serialize);
+        OGRFeature* feature = OGRFeature::CreateFeature(layer->GetLayerDefn());
+        for (size_t i = 0; i < fields.size(); ++i) {
+            if (fields[i].numeric) {
+                feature->SetField((int)i, fields[i].number);
+            } else {
+                feature->SetField((int)i, fields[i].text.c_str());
+            }
+        }
+        
+        OGRGeometry* ogrGeometry = toOgr(geometry);
+        if (ogrGeometry) {
+            feature->SetGeometryDirectly(ogrGeometry);
+        }
+        OGRErr err = layer->CreateFeature(feature);
+        OGRFeature::DestroyFeature(feature);
+        return err == OGRERR_NONE;
+    }
+    
+    bool close() override {
+        StageTimer timer(Stage::Serialize);
+        bool ok = !inTransaction || dataset->CommitTransaction() == OGRERR_NONE;
+        GDALClose(dataset);
+        dataset = nullptr;
+        return ok;
+    }
+    
+    // Поля копируются по именам, геометрия - как есть
+    bool copyFrom(const string& path, const OverlapFilter& keep, size_t& copied) override {
+        GDALDataset* previous = (GDALDataset*)GDALOpenEx(path.c_str(), GDAL_OF_VECTOR | GDAL_OF_READONLY,
+                                                         nullptr, nullptr, nullptr);
+        if (!previous) {
+            cerr << "Не удалось открыть прежний результат: " << path << endl;
+            return false;
+        }
+        OGRLayer* source = previous->GetLayerByName("overlaps");
+        if (!source && previous->GetLayerCount() > 0) {
+            source = previous->GetLayer(0);
+        }
+        if (!source) {
+            cerr << "В прежнем результате нет слоя: " << path << endl;
+            GDALClose(previous);
+            return false;
+        }
+        
+        int fieldA = source->GetLayerDefn()->GetFieldIndex("a");
+        int fieldB = source->GetLayerDefn()->GetFieldIndex("b");
+        bool ok = true;
+        source->ResetReading();
+        OGRFeature* feature;
+        while (ok && (feature = source->GetNextFeature()) != nullptr) {
+            string a = fieldA >= 0 ? feature->GetFieldAsString(fieldA) : "";
+            string b = fieldB >= 0 ? feature->GetFieldAsString(fieldB) : "";
+            if (keep(a, b)) {
+                OGRFeature* copy = OGRFeature::CreateFeature(layer->GetLayerDefn());
+                copy->SetFrom(feature);
+                ok = layer->CreateFeature(copy) == OGRERR_NONE;
+                OGRFeature::DestroyFeature(copy);
+                copied++;
+            }
+            OGRFeature::DestroyFeature(feature);
+        }
+        GDALClose(previous);
+        return ok;
+    }
+    
+private:
+    string driverName;
+    GDALDataset* dataset = nullptr;
+    OGRLayer* layer = nullptr;
+    bool inTransaction = false;
+    
+    // Обход колец как у GeoJSON: внешнее против часовой стрелки, дыры - по ней
+    static void orientRings(OGRGeometry* geometry) {
+        if (!geometry) {
+            return;
+        }
+        OGRwkbGeometryType type = wkbFlatten(geometry->getGeometryType());
+        if (type == wkbMultiPolygon) {
+            OGRMultiPolygon* multi = static_cast<OGRMultiPolygon*>(geometry);
+            for (int i = 0; i < multi->getNumGeometries(); ++i) {
+                orientRings(multi->getGeometryRef(i));
+            }
+        } else if (type == wkbPolygon) {
+            OGRPolygon* polygon = static_cast<OGRPolygon*>(geometry);
+            OGRLinearRing* exterior = polygon->getExteriorRing();
+            if (exterior && exterior->isClockwise()) {
+                exterior->reverseWindingOrder();
+            }
+            for (int i = 0; i < polygon->getNumInteriorRings(); ++i) {
+                OGRLinearRing* hole = polygon->getInteriorRing(i);
+                if (!hole->isClockwise()) {
+                    hole->reverseWindingOrder();
+                }
+            }
+        }
+    }
+    
+    static OGRGeometry* toOgr(const FeatureGeometry& geometry) {
+        if (geometry.box) {
+            const GeoBox& box = *geometry.box;
+            OGRLinearRing* ring = new OGRLinearRing();
+            ring->addPoint(box.minX, box.minY);
+            ring->addPoint(box.maxX, box.minY);
+            ring->addPoint(box.maxX, box.maxY);
+            ring->addPoint(box.minX, box.maxY);
+            ring->addPoint(box.minX, box.minY);
+            OGRPolygon* polygon = new OGRPolygon();
+            polygon->addRingDirectly(ring);
+            return polygon;
+        }
+        
+        #ifdef HAS_GEOS
+        if (geometry.geometry) {
+            GEOSContextHandle_t ctx = geosContext();
+            size_t size = 0;
+            unsigned char* wkb = GEOSGeomToWKB_buf_r(ctx, geometry.geometry, &size);
+            OGRGeometry* result = nullptr;
+            if (wkb) {
+                OGRGeometryFactory::createFromWkb(wkb, nullptr, &result, size);
+                GEOSFree_r(ctx, wkb);
+            }
+            orientRings(result);
+            return result;
+        }
+        #endif
+        return nullptr;
+    }
+};
+
+// Формат по расширению: .fgb - FlatGeobuf, .gpkg - GeoPackage, иначе GeoJSON
+static unique_ptr<FeatureWriter> createFeatureWriter(const string& path) {
+    string ext = filesystem::path(path).extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)tolower(c); });
+    if (ext == ".fgb") {
+        return unique_ptr<FeatureWriter>(new OgrFeatureWriter("FlatGeobuf"));
+    }
+    if (ext == ".gpkg") {
+        return unique_ptr<FeatureWriter>(new OgrFeatureWriter("GPKG"));
+    }
+    return unique_ptr<FeatureWriter>(new GeoJSONWriter());
+}
+
+// ---------------------------------------------------------------------------
+// Постоянный кэш валидных областей. Запись привязана к файлу растра
+// (абсолютный путь, размер, время изменения) и к параметрам, влияющим на
+// геометрию; хранит географический охват, число непрозрачных пикселей и
+// WKB геометрии. Прямоугольная область задается самим охватом и хранится
+// без WKB. Для неизменившегося растра GDAL не открывается.
+//
+// Формат файла (порядок байт платформы):
+//   "RIFC", uint32 версия, uint32 число записей, затем записи:
+//   строка путь, uint64 размер, int64 mtime, строка параметры,
+//   4 x double охват, uint8 прямоугольник, int64 число пикселей
+//   (-1 - не считалось), строка WKB (пустая для прямоугольника),
+//   строка CRS в WKT (пустая - не задана). Охват и WKB - в этой CRS.
+//   Строка - uint32 длина и байты.
+// ---------------------------------------------------------------------------
+// Путь растра в одном написании для любых форм записи: объект хранилища -
+// путь GDAL (/vsis3/ и т.п.), локальный файл - абсолютный нормализованный путь
+static string normalizedPath(const string& rasterPath) {
+    if (isRemotePath(rasterPath)) {
+        return gdalPath(rasterPath);
+    }
+    error_code ec;
+    filesystem::path absolute = filesystem::absolute(rasterPath, ec);
+    return ec ? rasterPath : absolute.lexically_normal().string();
+}
+
+struct FootprintCacheEntry {
+    string path;
+    uint64_t fileSize = 0;
+    int64_t mtime = 0;
+    string optionsKey;
+    double minX = 0, minY = 0, maxX = 0, maxY = 0;
+    bool rectangle = false;     // область - сам охват
+    int64_t opaqueCount = -1;
+    string wkb;
+    string crs;
+    // Охват всего растра по заголовку (для разбиения на шарды без открытия файла)
+    bool hasRasterBox = false;
+    double rasterMinX = 0, rasterMinY = 0, rasterMaxX = 0, rasterMaxY = 0;
+    
+    void setRasterBox(const GeoBox& box) {
+        hasRasterBox = true;
+        rasterMinX = box.minX;
+        rasterMinY = box.minY;
+        rasterMaxX = box.maxX;
+        rasterMaxY = box.maxY;
+    }
+};
+
+class FootprintCache {
+public:
+    explicit FootprintCache(const string& cachePath, const ProcessorOptions& options)
+        : cachePath(cachePath), optionsKey(makeOptionsKey(options)) {}
+    
+    bool load() {
+        ifstream in(cachePath, ios::binary);
+        if (!in) {
+            return true;    // кэша еще нет
+        }
+        
+        char magic[4];
+        uint32_t version = 0, count = 0;
+        in.read(magic, 4);
+        if (!in || memcmp(magic, "RIFC", 4) != 0 || !readPod(in, version) || version != formatVersion ||
+            !readPod(in, count)) {
+            cerr << "Файл кэша поврежден или другой версии, будет пересоздан: " << cachePath << endl;
+            return false;
+        }
+        
+        for (uint32_t i = 0; i < count; ++i) {
+            FootprintCacheEntry entry;
+            uint8_t rectangle = 0, hasRasterBox = 0;
+            if (!readString(in, entry.path) || !readPod(in, entry.fileSize) || !readPod(in, entry.mtime) ||
+                !readString(in, entry.optionsKey) || !readPod(in, entry.minX) || !readPod(in, entry.minY) ||
+                !readPod(in, entry.maxX) || !readPod(in, entry.maxY) || !readPod(in, rectangle) ||
+                !readPod(in, entry.opaqueCount) || !readString(in, entry.wkb) || !readString(in, entry.crs) ||
+                !readPod(in, hasRasterBox) || !readPod(in, entry.rasterMinX) || !readPod(in, entry.rasterMinY) ||
+                !readPod(in, entry.rasterMaxX) || !readPod(in, entry.rasterMaxY)) {
+                cerr << "Файл кэша обрезан: " << cachePath << endl;
+                entries.clear();
+                return false;
+            }
+            entry.rectangle = rectangle != 0;
+            entry.hasRasterBox = hasRasterBox != 0;
+            string key = entryKey(entry.path, entry.optionsKey);
+            entries[key] = move(entry);
+        }
+        return true;
+    }
+    
+    // Запись во временный файл и переименование, чтобы прерванный запуск не портил кэш
+    bool save() {
+        if (!dirty) {
+            return true;
+        }
+        
+        string tempPath = cachePath + ".tmp";
+        {
+            ofstream out(tempPath, ios::binary | ios::trunc);
+            if (!out) {
+                cerr << "Не удалось записать кэш: " << tempPath << endl;
+                return false;
+            }
+            out.write("RIFC", 4);
+            writePod(out, formatVersion);
+            writePod(out, (uint32_t)entries.size());
+            for (const auto& item : entries) {
+                const FootprintCacheEntry& entry = item.second;
+                writeString(out, entry.path);
+                writePod(out, entry.fileSize);
+                writePod(out, entry.mtime);
+                writeString(out, entry.optionsKey);
+                writePod(out, entry.minX);
+                writePod(out, entry.minY);
+                writePod(out, entry.maxX);
+                writePod(out, entry.maxY);
+                writePod(out, (uint8_t)(entry.rectangle ? 1 : 0));
+                writePod(out, entry.opaqueCount);
+                writeString(out, entry.wkb);
+                writeString(out, entry.crs);
+                writePod(out, (uint8_t)(entry.hasRasterBox ? 1 : 0));
+                writePod(out, entry.rasterMinX);
+                writePod(out, entry.rasterMinY);
+                writePod(out, entry.rasterMaxX);
+                writePod(out, entry.rasterMaxY);
+            }
+            if (!out) {
+                return false;
+            }
+        }
+        
+        error_code ec;
+        filesystem::rename(tempPath, cachePath, ec);
+        if (ec) {
+            cerr << "Не удалось заменить кэш: " << ec.message() << endl;
+            return false;
+        }
+        dirty = false;
+        return true;
+    }
+    
+    // Запись для неизменившегося файла или nullptr
+    const FootprintCacheEntry* find(const string& rasterPath) const {
+        FootprintCacheEntry identity;
+        if (!fileIdentity(rasterPath, identity)) {
+            return nullptr;
+        }
+        auto it = entries.find(entryKey(identity.path, optionsKey));
+        if (it == entries.end() || it->second.fileSize != identity.fileSize ||
+            it->second.mtime != identity.mtime) {
+            return nullptr;
+        }
+        return &it->second;
+    }
+    
+    void store(const string& rasterPath, FootprintCacheEntry entry) {
+        if (!fileIdentity(rasterPath, entry)) {
+            return;
+        }
+        entry.optionsKey = optionsKey;
+        entries[entryKey(entry.path, optionsKey)] = move(entry);
+        dirty = true;
+    }
+    
+    // Охват растра по заголовку для неизменившегося файла: из записи области
+    // или из отдельной записи охвата, не зависящей от параметров анализа
+    bool findRasterBox(const string& rasterPath, GeoBox& box, string& crs) const {
+        FootprintCacheEntry identity;
+        if (!fileIdentity(rasterPath, identity)) {
+            return false;
+        }
+        for (const string& key : {optionsKey, string(rasterBoxKey)}) {
+            auto it = entries.find(entryKey(identity.path, key));
+            if (it == entries.end() || !it->second.hasRasterBox || it->second.fileSize != identity.fileSize ||
+                it->second.mtime != identity.mtime) {
+                continue;
+            }
+            const FootprintCacheEntry& entry = it->second;
+            box.minX = entry.rasterMinX;
+            box.minY = entry.rasterMinY;
+            box.maxX = entry.rasterMaxX;
+            box.maxY = entry.rasterMaxY;
+            crs = entry.crs;
+            return true;
+        }
+        return false;
+    }
+    
+    void storeRasterBox(const string& rasterPath, const GeoBox& box, const string& crs) {
+        FootprintCacheEntry entry;
+        if (!fileIdentity(rasterPath, entry)) {
+            return;
+        }
+        entry.optionsKey = rasterBoxKey;
+        entry.crs = crs;
+        entry.setRasterBox(box);
+        entries[entryKey(entry.path, rasterBoxKey)] = move(entry);
+        dirty = true;
+    }
+    
+    size_t size() const {
+        return entries.size();
+    }
+    
+private:
+    static constexpr uint32_t formatVersion = 4;
+    static constexpr const char* rasterBoxKey = "raster-box";
+    
+    string cachePath;
+    string optionsKey;
+    map<string, FootprintCacheEntry> entries;
+    bool dirty = false;
+    
+    // Параметры, от которых зависит геометрия (способ хранения и ядро сканирования - нет).
+    // Записи с --overviews хранятся отдельно: границы ищутся другим путем.
+    static string makeOptionsKey(const ProcessorOptions& options) {
+        ostringstream key;
+        key << (options.footprint == FootprintMode::Polygon ? "polygon" : "bbox");
+        if (options.footprint == FootprintMode::Polygon) {
+            key.precision(17);
+            key << ";simplify=" << options.simplifyTolerance;
+        }
+        if (options.useOverviews) {
+            key << ";overviews";
+        }
+        return key.str();
+    }
+    
+    static string entryKey(const string& path, const string& options) {
+        return path + '\n' + options;
+    }
+    
+    static bool fileIdentity(const string& rasterPath, FootprintCacheEntry& entry) {
+        // Объект в хранилище: размер и время изменения из HEAD-запроса
+        if (isRemotePath(rasterPath)) {
+            string path = normalizedPath(rasterPath);
+            VSIStatBufL stat;
+            if (VSIStatL(path.c_str(), &stat) != 0) return false;
+            entry.path = path;
+            entry.fileSize = (uint64_t)stat.st_size;
+            entry.mtime = (int64_t)stat.st_mtime;
+            return true;
+        }
+        
+        error_code ec;
+        filesystem::path absolute = filesystem::absolute(rasterPath, ec);
+        if (ec) return false;
+        uint64_t size = filesystem::file_size(absolute, ec);
+        if (ec) return false;
+        auto mtime = filesystem::last_write_time(absolute, ec);
+        if (ec) return false;
+        
+        entry.path = normalizedPath(rasterPath);
+        entry.fileSize = size;
+        entry.mtime = (int64_t)mtime.time_since_epoch().count();
+        return true;
+    }
+    
+    template <typename T>
+    static bool readPod(istream& in, T& value) {
+        in.read(reinterpret_cast<char*>(&value), sizeof(T));
+        return (bool)in;
+    }
+    
+    template <typename T>
+    static void writePod(ostream& out, const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    
+    static bool readString(istream& in, string& value) {
+        uint32_t length = 0;
+        if (!readPod(in, length) || length > (1u << 30)) return false;
+        value.resize(length);
+        in.read(&value[0], length);
+        return (bool)in;
+    }
+    
+    static void writeString(ostream& out, const string& value) {
+        writePod(out, (uint32_t)value.size());
+        out.write(value.data(), value.size());
+    }
+};
+
+// Валидная область растра. Прямоугольная (со сторонами по осям) задается
+// одним охватом и пересекается без GEOS; произвольная хранится как
+// геометрия GEOS, и тогда box - ее охват. Координаты - в системе crs.
+struct Footprint {
+    string path;
+    GeoBox box;
+    bool rectangle = false;
+    string crs;     // WKT, пустая - не задана
+    #ifdef HAS_GEOS
+    GeosGeometryPtr geometry;
+    #endif
+    
+    bool valid() const {
+        #ifdef HAS_GEOS
+        return rectangle || geometry != nullptr;
+        #else
+        return rectangle;
+        #endif
+    }
+};
+
+#ifdef HAS_GEOS
+static GeosGeometryPtr boxToGEOS(const GeoBox& box) {
+    GEOSContextHandle_t ctx = geosContext();
+    const double xs[5] = {box.minX, box.maxX, box.maxX, box.minX, box.minX};
+    const double ys[5] = {box.minY, box.minY, box.maxY, box.maxY, box.minY};
+    GeosCoordSeqPtr coordSeq(GEOSCoordSeq_create_r(ctx, 5, 2));
+    for (unsigned i = 0; i < 5; ++i) {
+        GEOSCoordSeq_setX_r(ctx, coordSeq.get(), i, xs[i]);
+        GEOSCoordSeq_setY_r(ctx, coordSeq.get(), i, ys[i]);
+    }
+    return makePolygon(makeLinearRing(move(coordSeq)));
+}
+
+static GeoBox geometryBox(const GEOSGeometry* geometry) {
+    GEOSContextHandle_t ctx = geosContext();
+    GeoBox box;
+    GEOSGeom_getXMin_r(ctx, geometry, &box.minX);
+    GEOSGeom_getYMin_r(ctx, geometry, &box.minY);
+    GEOSGeom_getXMax_r(ctx, geometry, &box.maxX);
+    GEOSGeom_getYMax_r(ctx, geometry, &box.maxY);
+    return box;
+}
+#endif
+
+// Валидная область загруженного растра: прямоугольник, когда это возможно,
+// иначе геометрия GEOS (без GEOS такая область недоступна)
+static Footprint makeFootprint(RasterProcessor& processor, const string& path) {
+    StageTimer timer(Stage::Geometry);
+    Footprint footprint;
+    footprint.path = path;
+    footprint.crs = processor.getSpatialRefWkt();
+    if (processor.getValidBox(footprint.box)) {
+        footprint.rectangle = true;
+        #ifdef HAS_GEOS
+        // Геометрия нужна STR-дереву и пересечениям с непрямоугольными областями
+        footprint.geometry = boxToGEOS(footprint.box);
+        #endif
+        return footprint;
+    }
+    
+    #ifdef HAS_GEOS
+    footprint.geometry = processor.getValidGeometry();
+    if (footprint.geometry) {
+        footprint.box = geometryBox(footprint.geometry.get());
+    }
+    #endif
+    return footprint;
+}
+
+// Валидная область из записи кэша; false, если ее не восстановить
+static bool cacheEntryToFootprint(const FootprintCacheEntry& entry, const string& path, Footprint& footprint) {
+    footprint.path = path;
+    footprint.box = GeoBox{entry.minX, entry.minY, entry.maxX, entry.maxY};
+    footprint.rectangle = entry.rectangle;
+    footprint.crs = entry.crs;
+    #ifdef HAS_GEOS
+    if (entry.rectangle) {
+        footprint.geometry = boxToGEOS(footprint.box);
+    } else {
+        footprint.geometry.reset(GEOSGeomFromWKB_buf_r(geosContext(),
+                                                       reinterpret_cast<const unsigned char*>(entry.wkb.data()),
+                                                       entry.wkb.size()));
+    }
+    #endif
+    return footprint.valid();
+}
+
+static FootprintCacheEntry makeCacheEntry(const Footprint& footprint, const MaskStats& stats) {
+    FootprintCacheEntry entry;
+    entry.minX = footprint.box.minX;
+    entry.minY = footprint.box.minY;
+    entry.maxX = footprint.box.maxX;
+    entry.maxY = footprint.box.maxY;
+    entry.rectangle = footprint.rectangle;
+    entry.crs = footprint.crs;
+    #ifdef HAS_GEOS
+    if (!footprint.rectangle && footprint.geometry) {
+        GEOSContextHandle_t ctx = geosContext();
+        size_t size = 0;
+        unsigned char* wkb = GEOSGeomToWKB_buf_r(ctx, footprint.geometry.get(), &size);
+        if (wkb) {
+            entry.wkb.assign(reinterpret_cast<const char*>(wkb), size);
+            GEOSFree_r(ctx, wkb);
+        }
+    }
+    #endif
+    entry.opaqueCount = stats.hasCounts ? stats.opaqueCount : -1;
+    return entry;
+}
+
+#ifdef HAS_GEOS
+// Перевод вершин валидной области в другую CRS. Ребра предварительно
+// сгущаются (не длиннее 1/64 охвата), чтобы прямые в исходной проекции,
+// которые в целевой становятся кривыми, не срезались хордами. Растр не
+// трансформируется - только контур.
+static bool reprojectFootprint(Footprint& footprint, OGRCoordinateTransformation& transform, const string& targetWkt) {
+    StageTimer timer(Stage::Geometry);
+    const double densifySteps = 64.0;
+    GEOSContextHandle_t ctx = geosContext();
+    
+    size_t size = 0;
+    unsigned char* wkb = GEOSGeomToWKB_buf_r(ctx, footprint.geometry.get(), &size);
+    if (!wkb) {
+        return false;
+    }
+    OGRGeometry* geometry = nullptr;
+    OGRErr err = OGRGeometryFactory::createFromWkb(wkb, nullptr, &geometry, size);
+    GEOSFree_r(ctx, wkb);
+    if (err != OGRERR_NONE || !geometry) {
+        return false;
+    }
+    
+    double extent = max(footprint.box.maxX - footprint.box.minX, footprint.box.maxY - footprint.box.minY);
+    if (extent > 0) {
+        geometry->segmentize(extent / densifySteps);
+    }
+    if (geometry->transform(&transform) != OGRERR_NONE) {
+        OGRGeometryFactory::destroyGeometry(geometry);
+        return false;
+    }
+    
+    vector<unsigned char> buffer(geometry->WkbSize());
+    geometry->exportToWkb(wkbNDR, buffer.data());
+    OGRGeometryFactory::destroyGeometry(geometry);
+    
+    footprint.geometry.reset(GEOSGeomFromWKB_buf_r(ctx, buffer.data(), buffer.size()));
+    if (!footprint.geometry) {
+        return false;
+    }
+    // Прямоугольник после перепроецирования в общем случае уже не прямоугольник
+    footprint.rectangle = false;
+    footprint.box = geometryBox(footprint.geometry.get());
+    footprint.crs = targetWkt;
+    return true;
+}
+#endif
+
+// Приводит валидные области к общей CRS: заданной targetDefinition (EPSG:...,
+// WKT, PROJ) или, если она пуста, к CRS первой области, у которой она есть.
+// Области без CRS считаются заданными в целевой. Область, которую не
+// удалось перевести, исключается. Без GEOS перепроецирование недоступно.
+static bool alignFootprintCRS(vector<Footprint>& footprints, const string& targetDefinition) {
+    OGRSpatialReference target;
+    if (!targetDefinition.empty()) {
+        if (target.SetFromUserInput(targetDefinition.c_str()) != OGRERR_NONE) {
+            cerr << "Не удалось разобрать систему координат: " << targetDefinition << endl;
+            return false;
+        }
+    } else {
+        auto first = find_if(footprints.begin(), footprints.end(), [](const Footprint& footprint) {
+            return footprint.valid() && !footprint.crs.empty();
+        });
+        if (first == footprints.end()) {
+            return true;
+        }
+        target.importFromWkt(first->crs.c_str());
+    }
+    target.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+    
+    char* wkt = nullptr;
+    target.exportToWkt(&wkt);
+    string targetWkt = wkt ? wkt : "";
+    CPLFree(wkt);
+    
+    // Преобразование на каждую исходную CRS; nullptr - совпадает с целевой
+    struct SourceTransform {
+        bool ok = false;
+        unique_ptr<OGRCoordinateTransformation> transform;
+    };
+    map<string, SourceTransform> transforms;
+    size_t reprojected = 0;
+    
+    for (Footprint& footprint : footprints) {
+        if (!footprint.valid() || footprint.crs.empty()) {
+            continue;
+        }
+        
+        auto it = transforms.find(footprint.crs);
+        if (it == transforms.end()) {
+            SourceTransform entry;
+            OGRSpatialReference source;
+            if (source.importFromWkt(footprint.crs.c_str()) == OGRERR_NONE) {
+                source.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+                if (source.IsSame(&target)) {
+                    entry.ok = true;
+                } else {
+                    entry.transform.reset(OGRCreateCoordinateTransformation(&source, &target));
+                    entry.ok = entry.transform != nullptr;
+                }
+            }
+            it = transforms.emplace(footprint.crs, move(entry)).first;
+        }
+        
+        if (it->second.ok && !it->second.transform) {
+            continue;
+        }
+        
+        bool ok = false;
+        #ifdef HAS_GEOS
+        ok = it->second.ok && reprojectFootprint(footprint, *it->second.transform, targetWkt);
+        #endif
+        if (ok) {
+            reprojected++;
+            continue;
+        }
+        
+        #ifdef HAS_GEOS
+        cerr << "Не удалось перевести область в общую систему координат: " << footprint.path << endl;
+        footprint.geometry.reset();
+        #else
+        cerr << "Другая система координат, перепроецирование требует GEOS: " << footprint.path << endl;
+        #endif
+        footprint.rectangle = false;
+    }
+    
+    if (reprojected > 0) {
+        progress() << "Перепроецировано областей: " << reprojected << " в " << target.GetName() << '\n';
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Конвейер загрузки. Стадии открытия/чтения, сканирования маски и
+// построения валидной области (GEOS с контекстом потока) выполняются параллельно
+// для независимых входов, каждый со своим GDALDataset, а пересечение
+// идет в вызывающем потоке по мере готовности входов. Число готовых, но
+// еще не забранных входов ограничено числом заданий, чтобы маски не
+// копились в памяти быстрее, чем их успевают обработать.
+// ---------------------------------------------------------------------------
+struct LoadedRaster {
+    size_t index = 0;
+    unique_ptr<RasterProcessor> processor;
+    Footprint footprint;    // валидная область, если ее строил конвейер
+    string log;     // сообщения стадий загрузки, печатаются при выдаче
+    bool ok = false;
+};
+
+class LoadPipeline {
+public:
+    // Сообщения загрузки собираются, только если включен уровень logLevel;
+    // иначе процессоры пишут в пустой поток
+    LoadPipeline(const vector<string>& inputs, const ProcessorOptions& options,
+                 int jobs, bool printDetails, Verbosity logLevel, bool buildFootprint = false)
+        : inputs(inputs), options(options), printDetails(printDetails), logLevel(logLevel),
+          buildFootprint(buildFootprint), nextInput(0), delivered(0) {
+        if (jobs <= 0) {
+            jobs = (int)thread::hardware_concurrency();
+        }
+        limit = (size_t)max(1, jobs);
+        registerDrivers();
+        int workerCount = (int)min(limit, inputs.size());
+        for (int i = 0; i < workerCount; ++i) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+    
+    ~LoadPipeline() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        changed.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    }
+    
+    // Следующий готовый вход в порядке завершения; false, когда выданы все
+    bool next(LoadedRaster& result) {
+        unique_lock<mutex> guard(lock);
+        if (delivered == inputs.size()) {
+            return false;
+        }
+        changed.wait(guard, [this]() { return !ready.empty(); });
+        result = move(ready.front());
+        ready.pop_front();
+        delivered++;
+        changed.notify_all();
+        return true;
+    }
+    
+private:
+    const vector<string>& inputs;
+    ProcessorOptions options;
+    bool printDetails;
+    Verbosity logLevel;
+    bool buildFootprint;
+    size_t limit;
+    atomic<size_t> nextInput;
+    size_t delivered;
+    bool stopping = false;
+    
+    mutex lock;
+    condition_variable changed;
+    deque<LoadedRaster> ready;
+    vector<thread> workers;
+    
+    void work() {
+        while (true) {
+            size_t index = nextInput++;
+            if (index >= inputs.size()) {
+                return;
+            }
+            
+            LoadedRaster loaded;
+            loaded.index = index;
+            loaded.processor.reset(new RasterProcessor(options));
+            bool logging = logEnabled(logLevel);
+            ostringstream log;
+            if (logging) {
+                loaded.processor->setLog(log);
+            } else {
+                loaded.processor->silenceLog();
+            }
+            loaded.ok = loaded.processor->loadRaster(inputs[index]);
+            if (loaded.ok && printDetails && logging) {
+                loaded.processor->printDetailedInfo();
+            }
+            if (loaded.ok && buildFootprint) {
+                loaded.footprint = makeFootprint(*loaded.processor, inputs[index]);
+            }
+            if (logging) {
+                loaded.processor->setLog(cout);
+                loaded.log = log.str();
+            }
+            
+            unique_lock<mutex> guard(lock);
+            changed.wait(guard, [this]() { return stopping || ready.size() < limit; });
+            if (stopping) {
+                return;
+            }
+            ready.push_back(move(loaded));
+            changed.notify_all();
+        }
+    }
+};
+
+static bool hasRasterExtension(const filesystem::path& path) {
+    static const vector<string> extensions = {".tif", ".tiff", ".vrt", ".img", ".jp2"};
+    string ext = path.extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)tolower(c); });
+    return find(extensions.begin(), extensions.end(), ext) != extensions.end();
+}
+
+vector<string> collectInputs(const string& source) {
+    vector<string> inputs;
+    
+    // Префикс в хранилище (s3://bucket/prefix/ и т.п.) - листинг через VSI
+    if (isRemotePath(source)) {
+        registerDrivers();
+        string prefix = gdalPath(source);
+        while (prefix.size() > 1 && prefix.back() == '/') prefix.pop_back();
+        VSIStatBufL stat;
+        if (VSIStatL(prefix.c_str(), &stat) == 0 && VSI_ISDIR(stat.st_mode)) {
+            char** names = VSIReadDir(prefix.c_str());
+            for (char** name = names; name && *name; ++name) {
+                if (hasRasterExtension(*name)) {
+                    inputs.push_back(prefix + "/" + *name);
+                }
+            }
+            CSLDestroy(names);
+            sort(inputs.begin(), inputs.end());
+            return inputs;
+        }
+    }
+    
+    error_code ec;
+    if (filesystem::is_directory(source, ec)) {
+        for (const auto& entry : filesystem::directory_iterator(source, ec)) {
+            if (entry.is_regular_file() && hasRasterExtension(entry.path())) {
+                inputs.push_back(entry.path().string());
+            }
+        }
+        sort(inputs.begin(), inputs.end());
+        return inputs;
+    }
+    
+    ifstream list(source);
+    string line;
+    while (getline(list, line)) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.pop_back();
+        if (!line.empty() && line[0] != '#') {
+            inputs.push_back(line);
+        }
+    }
+    return inputs;
+}
+
+// Валидные области входов в порядке входов: неизменившиеся растры берутся
+// из кэша, остальные строятся конвейером; у пропущенных valid() == false.
+// Растры из refresh (пути в виде normalizedPath) строятся заново, даже если
+// запись кэша совпала.
+static vector<Footprint> loadFootprints(const vector<string>& inputs, const ProcessorOptions& options,
+                                        int jobs, FootprintCache* cache, const set<string>* refresh = nullptr) {
+    vector<Footprint> footprints(inputs.size());
+    vector<string> pending;
+    vector<size_t> pendingIndex;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        bool forced = refresh && refresh->count(normalizedPath(inputs[i])) > 0;
+        const FootprintCacheEntry* entry = cache && !forced ? cache->find(inputs[i]) : nullptr;
+        if (!entry || !cacheEntryToFootprint(*entry, inputs[i], footprints[i])) {
+            pending.push_back(inputs[i]);
+            pendingIndex.push_back(i);
+        }
+    }
+    if (cache) {
+        progress() << "Из кэша: " << inputs.size() - pending.size() << ", к расчету: " << pending.size() << '\n';
+    }
+    
+    // Область строится в потоках конвейера, после чего процессор
+    // с маской сразу освобождается
+    LoadPipeline pipeline(pending, options, jobs, false, Verbosity::Verbose, true);
+    LoadedRaster loaded;
+    while (pipeline.next(loaded)) {
+        progress() << loaded.log;
+        size_t index = pendingIndex[loaded.index];
+        const string& path = inputs[index];
+        if (!loaded.ok) {
+            cerr << "Пропущен: " << path << endl;
+            continue;
+        }
+        footprints[index] = move(loaded.footprint);
+        if (!footprints[index].valid()) {
+            cerr << "Нет валидной области: " << path << endl;
+        } else if (cache) {
+            FootprintCacheEntry entry = makeCacheEntry(footprints[index], loaded.processor->getMaskStats());
+            entry.setRasterBox(loaded.processor->getRasterBox());
+            cache->store(path, move(entry));
+        }
+        loaded.processor.reset();
+    }
+    return footprints;
+}
+
+// Непустое пересечение двух валидных областей: прямоугольник или геометрия
+// GEOS. Геометрия либо принадлежит результату, либо заимствована у области
+// (кандидат целиком внутри опорной области в режиме один ко многим).
+struct Overlap {
+    double area = 0.0;
+    bool rectangle = false;
+    GeoBox box;
+    #ifdef HAS_GEOS
+    GeosGeometryPtr owned;
+    const GEOSGeometry* geometry = nullptr;
+    #endif
+    
+    FeatureGeometry feature() const {
+        FeatureGeometry result;
+        if (rectangle) {
+            result.box = &box;
+        }
+        #ifdef HAS_GEOS
+        else {
+            result.geometry = geometry;
+        }
+        #endif
+        return result;
+    }
+};
+
+// Пересечение двух валидных областей; false, если оно пустое.
+// Прямоугольные области пересекаются четырьмя min/max без GEOS.
+static bool intersectFootprints(const Footprint& a, const Footprint& b, Overlap& overlap) {
+    StageTimer timer(Stage::Intersection);
+    if (a.rectangle && b.rectangle) {
+        overlap.box = a.box.intersection(b.box);
+        if (overlap.box.empty()) {
+            return false;
+        }
+        overlap.rectangle = true;
+        overlap.area = overlap.box.area();
+        return true;
+    }
+    
+    #ifdef HAS_GEOS
+    GEOSContextHandle_t ctx = geosContext();
+    GeosGeometryPtr intersection(GEOSIntersection_r(ctx, a.geometry.get(), b.geometry.get()));
+    if (!intersection || GEOSisEmpty_r(ctx, intersection.get())) {
+        return false;
+    }
+    // Касание по стороне или в точке (линия, точка) пересечением не считается,
+    // как и у прямоугольников
+    if (!GEOSArea_r(ctx, intersection.get(), &overlap.area) || overlap.area <= 0) {
+        return false;
+    }
+    overlap.rectangle = false;
+    overlap.geometry = intersection.get();
+    overlap.owned = move(intersection);
+    return true;
+    #else
+    return false;
+    #endif
+}
+
+// Атрибуты признака пересечения пары растров
+static vector<FeatureField> overlapSchema() {
+    vector<FeatureField> schema(3);
+    schema[0].name = "a";
+    schema[1].name = "b";
+    schema[2].name = "area";
+    schema[2].numeric = true;
+    return schema;
+}
+
+// Пары считаются порциями: результаты порции вычисляются параллельно и
+// пишутся по порядку, так что в памяти живет не больше одной порции
+constexpr int overlapChunkSize = 4096;
+
+// Признак пересечения пары растров; fields - буфер атрибутов по
+// overlapSchema, переиспользуемый между признаками
+static bool writeOverlap(FeatureWriter& writer, vector<FeatureField>& fields,
+                         const string& pathA, const string& pathB, const Overlap& overlap) {
+    fields[0].text = pathA;
+    fields[1].text = pathB;
+    fields[2].number = overlap.area;
+    return writer.write(fields, overlap.feature());
+}
+
+// Открывает файл результата; CRS берется у первой валидной области
+static unique_ptr<FeatureWriter> openFeatureWriter(const string& outputPath, const vector<Footprint>& footprints,
+                                                   const vector<FeatureField>& schema) {
+    string crs;
+    for (const Footprint& footprint : footprints) {
+        if (footprint.valid()) {
+            crs = footprint.crs;
+            break;
+        }
+    }
+    unique_ptr<FeatureWriter> writer = createFeatureWriter(outputPath);
+    if (!writer->open(outputPath, crs, schema)) {
+        return nullptr;
+    }
+    return writer;
+}
+
+#ifdef HAS_GEOS
+static void collectCandidate(void* item, void* userdata) {
+    static_cast<vector<size_t>*>(userdata)->push_back(*static_cast<size_t*>(item));
+}
+#endif
+
+// Пары (i < j) с пересекающимися охватами в порядке i, затем j. С GEOS - через
+// STR-дерево; вставка в него заодно вычисляет охваты геометрий, так что
+// дальше потоки только читают их. Без GEOS - заметание по minX.
+static vector<pair<size_t, size_t>> findCandidatePairs(const vector<Footprint>& footprints) {
+    vector<pair<size_t, size_t>> pairs;
+    
+    #ifdef HAS_GEOS
+    GEOSContextHandle_t ctx = geosContext();
+    GEOSSTRtree* tree = GEOSSTRtree_create_r(ctx, 10);
+    vector<size_t> ids(footprints.size());
+    for (size_t i = 0; i < footprints.size(); ++i) {
+        ids[i] = i;
+        GEOSSTRtree_insert_r(ctx, tree, footprints[i].geometry.get(), &ids[i]);
+    }
+    
+    vector<size_t> candidates;
+    for (size_t i = 0; i < footprints.size(); ++i) {
+        candidates.clear();
+        GEOSSTRtree_query_r(ctx, tree, footprints[i].geometry.get(), collectCandidate, &candidates);
+        sort(candidates.begin(), candidates.end());
+        for (size_t j : candidates) {
+            if (j > i) pairs.push_back({i, j});
+        }
+    }
+    GEOSSTRtree_destroy_r(ctx, tree);
+    #else
+    vector<size_t> order(footprints.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return footprints[a].box.minX < footprints[b].box.minX;
+    });
+    
+    // Активны охваты, которые еще не закончились левее текущего
+    vector<size_t> active;
+    for (size_t k : order) {
+        const GeoBox& box = footprints[k].box;
+        size_t kept = 0;
+        for (size_t m = 0; m < active.size(); ++m) {
+            const GeoBox& other = footprints[active[m]].box;
+            if (other.maxX < box.minX) {
+                continue;
+            }
+            active[kept++] = active[m];
+            if (other.minY <= box.maxY && box.minY <= other.maxY) {
+                pairs.push_back({min(active[m], k), max(active[m], k)});
+            }
+        }
+        active.resize(kept);
+        active.push_back(k);
+    }
+    sort(pairs.begin(), pairs.end());
+    #endif
+    
+    return pairs;
+}
+
+// Пары (i < j), в которых хотя бы одна область из probes и охваты
+// пересекаются, по возрастанию. Индекс строится по всем областям, но
+// опрашивается только для probes: O(n log n + probes * log n + k).
+static vector<pair<size_t, size_t>> findPairsTouching(const vector<Footprint>& footprints, const vector<size_t>& probes) {
+    vector<pair<size_t, size_t>> pairs;
+    
+    #ifdef HAS_GEOS
+    GEOSContextHandle_t ctx = geosContext();
+    GEOSSTRtree* tree = GEOSSTRtree_create_r(ctx, 10);
+    vector<size_t> ids(footprints.size());
+    for (size_t i = 0; i < footprints.size(); ++i) {
+        ids[i] = i;
+        GEOSSTRtree_insert_r(ctx, tree, footprints[i].geometry.get(), &ids[i]);
+    }
+    
+    vector<size_t> candidates;
+    for (size_t i : probes) {
+        candidates.clear();
+        GEOSSTRtree_query_r(ctx, tree, footprints[i].geometry.get(), collectCandidate, &candidates);
+        for (size_t j : candidates) {
+            if (j != i) pairs.push_back({min(i, j), max(i, j)});
+        }
+    }
+    GEOSSTRtree_destroy_r(ctx, tree);
+    #else
+    for (size_t i : probes) {
+        const GeoBox& box = footprints[i].box;
+        for (size_t j = 0; j < footprints.size(); ++j) {
+            const GeoBox& other = footprints[j].box;
+            if (j != i && other.minX <= box.maxX && box.minX <= other.maxX &&
+                other.minY <= box.maxY && box.minY <= other.maxY) {
+                pairs.push_back({min(i, j), max(i, j)});
+            }
+        }
+    }
+    #endif
+    
+    // Пара двух областей из probes найдена с обеих сторон
+    sort(pairs.begin(), pairs.end());
+    pairs.erase(unique(pairs.begin(), pairs.end()), pairs.end());
+    return pairs;
+}
+
+// Пересечения пар порциями по overlapChunkSize: порция считается
+// параллельно в jobs потоках и пишется по порядку, так что порядок
+// признаков не зависит от числа потоков. false - ошибка записи.
+static bool writePairOverlaps(FeatureWriter& writer, vector<FeatureField>& fields, const vector<Footprint>& footprints,
+                              const vector<pair<size_t, size_t>>& pairs, int jobs,
+                              size_t& written, size_t& rectanglePairs) {
+    vector<Overlap> overlaps;
+    vector<char> found;
+    atomic<size_t> rectangles(0);
+    TileScheduler scheduler(jobs);
+    for (size_t start = 0; start < pairs.size(); start += overlapChunkSize) {
+        int count = (int)min(pairs.size() - start, (size_t)overlapChunkSize);
+        overlaps.clear();
+        overlaps.resize(count);
+        found.assign(count, 0);
+        scheduler.run(count, [&](int index, int) {
+            const Footprint& a = footprints[pairs[start + index].first];
+            const Footprint& b = footprints[pairs[start + index].second];
+            if (a.rectangle && b.rectangle) {
+                rectangles++;
+            }
+            found[index] = intersectFootprints(a, b, overlaps[index]);
+        });
+        
+        for (int i = 0; i < count; ++i) {
+            if (!found[i]) {
+                continue;
+            }
+            const pair<size_t, size_t>& candidates = pairs[start + i];
+            if (!writeOverlap(writer, fields, footprints[candidates.first].path,
+                              footprints[candidates.second].path, overlaps[i])) {
+                return false;
+            }
+            written++;
+        }
+    }
+    rectanglePairs += rectangles;
+    return true;
+}
+
+// Пакетный режим: валидная область каждого растра вычисляется ровно один раз, пары-кандидаты
+// находятся по охватам, а пересечение считается только для них -
+// O(n log n + k) вместо перебора всех пар. Пересечения пар независимы и
+// считаются параллельно; пары прямоугольных областей обходятся без GEOS,
+// поэтому режим работает и в сборке без него.
+int runBatchMode(const vector<string>& inputs, const ProcessorOptions& options, const JobSettings& job) {
+    progress() << "Пакетный режим: растров " << inputs.size() << '\n';
+    
+    vector<Footprint> loaded = loadFootprints(inputs, options, job.jobs, job.cache);
+    if (!alignFootprintCRS(loaded, job.targetCrs)) {
+        return 1;
+    }
+    vector<Footprint> footprints;
+    footprints.reserve(loaded.size());
+    for (Footprint& footprint : loaded) {
+        if (footprint.valid()) {
+            footprints.push_back(move(footprint));
+        }
+    }
+    
+    vector<pair<size_t, size_t>> pairs = findCandidatePairs(footprints);
+    
+    vector<FeatureField> fields = overlapSchema();
+    unique_ptr<FeatureWriter> writer = openFeatureWriter(job.outputPath, footprints, fields);
+    if (!writer) {
+        return 1;
+    }
+    
+    size_t written = 0, rectanglePairs = 0;
+    if (!writePairOverlaps(*writer, fields, footprints, pairs, job.jobs, written, rectanglePairs) ||
+        !writer->close()) {
+        cerr << "Ошибка записи: " << job.outputPath << endl;
+        return 1;
+    }
+    
+    progress() << "Пар-кандидатов: " << pairs.size() << " (прямоугольных: " << rectanglePairs
+               << "), пересечений: " << written << '\n';
+    progress() << "Файл " << job.outputPath << " создан!" << '\n';
+    return 0;
+}
+
+// Временный файл рядом с результатом, с тем же расширением: по нему
+// драйвер OGR выбирает формат
+static string temporaryOutputPath(const string& outputPath) {
+    filesystem::path path(outputPath);
+    filesystem::path temp = path.parent_path() / (path.stem().string() + ".tmp" + path.extension().string());
+    return temp.string();
+}
+
+// Обновление результата пакетного режима после замены части растров.
+// Заново строятся только области changed (остальные - из кэша), индекс
+// опрашивается только ими, и пересчитываются лишь их пары. Признаки
+// прежнего результата с другими растрами переносятся без пересчета;
+// признаки с растрами из changed, которых больше нет среди inputs
+// (удаленные), отбрасываются. Результат пишется во временный файл и
+// заменяет прежний, так что прерванный запуск его не портит.
+int runIncrementalMode(const vector<string>& inputs, const vector<string>& changed,
+                       const ProcessorOptions& options, const JobSettings& job) {
+    error_code ec;
+    if (!filesystem::exists(job.outputPath, ec)) {
+        cerr << "Нет прежнего результата для обновления: " << job.outputPath << endl;
+        return 1;
+    }
+    if (!job.cache) {
+        cerr << "Без --cache области всех растров строятся заново" << endl;
+    }
+    
+    // Пути сравниваются в одном написании, как в кэше: ./a.tif и a.tif - один растр
+    set<string> changedSet;
+    for (const string& path : changed) {
+        changedSet.insert(normalizedPath(path));
+    }
+    auto isChanged = [&](const string& path) { return changedSet.count(normalizedPath(path)) > 0; };
+    progress() << "Обновление результата: растров " << inputs.size() << ", изменились " << changedSet.size() << '\n';
+    
+    vector<Footprint> loaded = loadFootprints(inputs, options, job.jobs, job.cache, &changedSet);
+    if (!alignFootprintCRS(loaded, job.targetCrs)) {
+        return 1;
+    }
+    vector<Footprint> footprints;
+    vector<size_t> probes;
+    footprints.reserve(loaded.size());
+    for (Footprint& footprint : loaded) {
+        if (!footprint.valid()) {
+            continue;
+        }
+        if (isChanged(footprint.path)) {
+            probes.push_back(footprints.size());
+        }
+        footprints.push_back(move(footprint));
+    }
+    
+    vector<pair<size_t, size_t>> pairs = findPairsTouching(footprints, probes);
+    
+    string tempPath = temporaryOutputPath(job.outputPath);
+    vector<FeatureField> fields = overlapSchema();
+    unique_ptr<FeatureWriter> writer = openFeatureWriter(tempPath, footprints, fields);
+    if (!writer) {
+        return 1;
+    }
+    
+    size_t kept = 0, written = 0, rectanglePairs = 0;
+    bool ok = writer->copyFrom(job.outputPath, [&](const string& a, const string& b) {
+        return !isChanged(a) && !isChanged(b);
+    }, kept);
+    ok = ok && writePairOverlaps(*writer, fields, footprints, pairs, job.jobs, written, rectanglePairs);
+    ok = writer->close() && ok;
+    if (!ok) {
+        cerr << "Ошибка записи: " << tempPath << endl;
+        filesystem::remove(tempPath, ec);
+        return 1;
+    }
+    filesystem::rename(tempPath, job.outputPath, ec);
+    if (ec) {
+        cerr << "Не удалось заменить результат: " << ec.message() << endl;
+        return 1;
+    }
+    
+    progress() << "Сохранено пересечений: " << kept << ", пар-кандидатов пересчитано: " << pairs.size()
+               << " (прямоугольных: " << rectanglePairs << "), новых пересечений: " << written << '\n';
+    progress() << "Файл " << job.outputPath << " обновлен!" << '\n';
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Распределенный пакетный режим. Каждый узел запускается с тем же списком
+// входов и своим номером шарда и без обмена данными получает одно и то же
+// разбиение: охваты растров по геотрансформациям (только заголовки)
+// упорядочиваются по квадранному ключу центра (кривая Z в общем охвате) и
+// делятся на N равных по числу растров отрезков. Пара с пересекающимися
+// охватами принадлежит шарду растра, стоящего в этом порядке раньше, так
+// что каждая пара считается ровно одним шардом. Шард строит области своих
+// растров, имеющих пары, и "ореол" - их соседей из других шардов.
+// ---------------------------------------------------------------------------
+
+// Квадрантный ключ уровня 16: чередование битов координат центра охвата
+static uint32_t quadKey(const GeoBox& extent, const GeoBox& box) {
+    auto cell = [](double value, double minimum, double maximum) {
+        double fraction = maximum > minimum ? (value - minimum) / (maximum - minimum) : 0.0;
+        return (uint32_t)min(65535.0, max(0.0, floor(fraction * 65536.0)));
+    };
+    uint32_t ix = cell((box.minX + box.maxX) / 2, extent.minX, extent.maxX);
+    uint32_t iy = cell((box.minY + box.maxY) / 2, extent.minY, extent.maxY);
+    uint32_t key = 0;
+    for (int bit = 0; bit < 16; ++bit) {
+        key |= ((ix >> bit) & 1u) << (2 * bit);
+        key |= ((iy >> bit) & 1u) << (2 * bit + 1);
+    }
+    return key;
+}
+
+// Охваты всех входов по заголовкам, параллельно; пиксели не читаются.
+// Охват неизменившегося растра берется из кэша без открытия файла, новые
+// охваты сохраняются в кэш. Всегда это охват растра, а не данных, поэтому
+// разбиение одинаково на узлах с кэшем и без него.
+static vector<Footprint> rasterExtents(const vector<string>& inputs, const ProcessorOptions& options, int jobs,
+                                       FootprintCache* cache) {
+    vector<Footprint> extents(inputs.size());
+    vector<char> opened(inputs.size(), 0);
+    TileScheduler scheduler(jobs);
+    scheduler.run((int)inputs.size(), [&](int index, int) {
+        Footprint& extent = extents[index];
+        if (!cache || !cache->findRasterBox(inputs[index], extent.box, extent.crs)) {
+            RasterProcessor processor(options);
+            processor.silenceLog();
+            if (!processor.openRaster(inputs[index])) {
+                return;
+            }
+            extent.box = processor.getRasterBox();
+            extent.crs = processor.getSpatialRefWkt();
+            opened[index] = 1;
+        }
+        extent.path = inputs[index];
+        extent.rectangle = true;
+        #ifdef HAS_GEOS
+        extent.geometry = boxToGEOS(extent.box);
+        #endif
+    });
+    
+    size_t fromCache = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (!extents[i].valid()) {
+            continue;
+        }
+        if (!opened[i]) {
+            fromCache++;
+        } else if (cache) {
+            cache->storeRasterBox(inputs[i], extents[i].box, extents[i].crs);
+        }
+    }
+    if (cache) {
+        progress() << "Охватов из кэша: " << fromCache << '\n';
+    }
+    return extents;
+}
+
+int runShardMode(const vector<string>& inputs, const ProcessorOptions& options, const JobSettings& job) {
+    progress() << "Шард " << job.shardIndex << "/" << job.shardCount << ": растров всего " << inputs.size() << '\n';
+    
+    // Разбиение: одинаково на всех узлах при одинаковом списке входов.
+    // Общая CRS без --crs - первого растра списка, а не первого своего.
+    vector<Footprint> planned = rasterExtents(inputs, options, job.jobs, job.cache);
+    string targetCrs = job.targetCrs;
+    if (targetCrs.empty()) {
+        for (const Footprint& extent : planned) {
+            if (extent.valid() && !extent.crs.empty()) {
+                targetCrs = extent.crs;
+                break;
+            }
+        }
+    }
+    if (!alignFootprintCRS(planned, targetCrs)) {
+        return 1;
+    }
+    vector<Footprint> extents;
+    for (Footprint& extent : planned) {
+        if (extent.valid()) {
+            extents.push_back(move(extent));
+        }
+    }
+    if (extents.empty()) {
+        cerr << "Нет растров с охватом" << endl;
+        return 1;
+    }
+    
+    GeoBox total = extents[0].box;
+    for (const Footprint& extent : extents) {
+        total.minX = min(total.minX, extent.box.minX);
+        total.minY = min(total.minY, extent.box.minY);
+        total.maxX = max(total.maxX, extent.box.maxX);
+        total.maxY = max(total.maxY, extent.box.maxY);
+    }
+    vector<uint32_t> keys(extents.size());
+    vector<size_t> order(extents.size());
+    for (size_t i = 0; i < extents.size(); ++i) {
+        keys[i] = quadKey(total, extents[i].box);
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return keys[a] != keys[b] ? keys[a] < keys[b] : extents[a].path < extents[b].path;
+    });
+    vector<size_t> rank(extents.size());
+    for (size_t position = 0; position < order.size(); ++position) {
+        rank[order[position]] = position;
+    }
+    
+    size_t count = extents.size();
+    size_t begin = count * job.shardIndex / job.shardCount;
+    size_t end = count * (job.shardIndex + 1) / job.shardCount;
+    auto owned = [&](size_t index) { return rank[index] >= begin && rank[index] < end; };
+    
+    // Растры, нужные парам шарда: свои и соседи из ореола
+    vector<size_t> probes;
+    for (size_t i = 0; i < extents.size(); ++i) {
+        if (owned(i)) probes.push_back(i);
+    }
+    set<string> needed;
+    size_t plannedPairs = 0;
+    for (const pair<size_t, size_t>& candidate : findPairsTouching(extents, probes)) {
+        size_t first = rank[candidate.first] < rank[candidate.second] ? candidate.first : candidate.second;
+        if (owned(first)) {
+            needed.insert(extents[candidate.first].path);
+            needed.insert(extents[candidate.second].path);
+            plannedPairs++;
+        }
+    }
+    map<string, size_t> extentRank;
+    size_t halo = 0;
+    for (size_t i = 0; i < extents.size(); ++i) {
+        extentRank[extents[i].path] = rank[i];
+        if (needed.count(extents[i].path) && !owned(i)) halo++;
+    }
+    extents.clear();
+    progress() << "Своих растров: " << end - begin << ", из ореола: " << halo
+               << ", пар по охватам: " << plannedPairs << '\n';
+    
+    // Области нужных растров строятся (или берутся из кэша) только здесь
+    vector<string> shardInputs;
+    for (const string& path : inputs) {
+        if (needed.count(path)) shardInputs.push_back(path);
+    }
+    vector<Footprint> loaded = loadFootprints(shardInputs, options, job.jobs, job.cache);
+    if (!alignFootprintCRS(loaded, targetCrs)) {
+        return 1;
+    }
+    vector<Footprint> footprints;
+    vector<size_t> shardProbes;
+    for (Footprint& footprint : loaded) {
+        if (!footprint.valid()) {
+            continue;
+        }
+        size_t position = extentRank[footprint.path];
+        if (position >= begin && position < end) {
+            shardProbes.push_back(footprints.size());
+        }
+        footprints.push_back(move(footprint));
+    }
+    
+    vector<pair<size_t, size_t>> pairs;
+    for (const pair<size_t, size_t>& candidate : findPairsTouching(footprints, shardProbes)) {
+        size_t first = min(extentRank[footprints[candidate.first].path], extentRank[footprints[candidate.second].path]);
+        if (first >= begin && first < end) {
+            pairs.push_back(candidate);
+        }
+    }
+    
+    vector<FeatureField> fields = overlapSchema();
+    unique_ptr<FeatureWriter> writer = openFeatureWriter(job.outputPath, footprints, fields);
+    if (!writer) {
+        return 1;
+    }
+    size_t written = 0, rectanglePairs = 0;
+    if (!writePairOverlaps(*writer, fields, footprints, pairs, job.jobs, written, rectanglePairs) ||
+        !writer->close()) {
+        cerr << "Ошибка записи: " << job.outputPath << endl;
+        return 1;
+    }
+    
+    progress() << "Пар-кандидатов: " << pairs.size() << " (прямоугольных: " << rectanglePairs
+               << "), пересечений: " << written << '\n';
+    progress() << "Файл " << job.outputPath << " создан!" << '\n';
+    return 0;
+}
+
+// CRS слоя результата в формате OGR; у GeoJSON писатель ее не использует,
+// поэтому файл не разбирается
+static string resultSpatialRef(const string& path) {
+    string ext = filesystem::path(path).extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)tolower(c); });
+    if (ext != ".fgb" && ext != ".gpkg") {
+        return string();
+    }
+    GDALDataset* dataset = (GDALDataset*)GDALOpenEx(path.c_str(), GDAL_OF_VECTOR | GDAL_OF_READONLY,
+                                                    nullptr, nullptr, nullptr);
+    if (!dataset) {
+        return string();
+    }
+    string result;
+    OGRLayer* layer = dataset->GetLayerCount() > 0 ? dataset->GetLayer(0) : nullptr;
+    const OGRSpatialReference* srs = layer ? layer->GetSpatialRef() : nullptr;
+    char* wkt = nullptr;
+    if (srs && srs->exportToWkt(&wkt) == OGRERR_NONE && wkt) {
+        result = wkt;
+    }
+    CPLFree(wkt);
+    GDALClose(dataset);
+    return result;
+}
+
+// Слияние результатов шардов в один файл того же формата. Пара (a, b)
+// попадает в результат один раз, даже если шарды пересекались (повторный
+// запуск шарда, другое разбиение).
+int runMergeMode(const vector<string>& parts, const JobSettings& job) {
+    registerDrivers();
+    vector<FeatureField> fields = overlapSchema();
+    // У шарда без пар слой мог быть создан без CRS
+    string crs;
+    for (size_t i = 0; i < parts.size() && crs.empty(); ++i) {
+        crs = resultSpatialRef(parts[i]);
+    }
+    unique_ptr<FeatureWriter> writer = createFeatureWriter(job.outputPath);
+    if (!writer->open(job.outputPath, crs, fields)) {
+        return 1;
+    }
+    
+    set<string> seen;
+    size_t total = 0, duplicates = 0;
+    for (const string& part : parts) {
+        size_t copied = 0;
+        bool ok = writer->copyFrom(part, [&](const string& a, const string& b) {
+            if (a.empty() && b.empty()) {
+                return true;
+            }
+            if (!seen.insert(a + '\n' + b).second) {
+                duplicates++;
+                return false;
+            }
+            return true;
+        }, copied);
+        if (!ok) {
+            writer->close();
+            return 1;
+        }
+        total += copied;
+    }
+    if (!writer->close()) {
+        cerr << "Ошибка записи: " << job.outputPath << endl;
+        return 1;
+    }
+    
+    progress() << "Объединено файлов: " << parts.size() << ", пересечений: " << total
+               << ", повторов отброшено: " << duplicates << '\n';
+    progress() << "Файл " << job.outputPath << " создан!" << '\n';
+    return 0;
+}
+
+#ifdef HAS_GEOS
+struct GeosPreparedDeleter {
+    void operator()(const GEOSPreparedGeometry* prepared) const {
+        GEOSPreparedGeom_destroy_r(geosContext(), prepared);
+    }
+};
+
+using GeosPreparedPtr = unique_ptr<const GEOSPreparedGeometry, GeosPreparedDeleter>;
+
+// Режим "один ко многим": inputs[0] - опорный растр, остальные - кандидаты.
+// Опорная область подготавливается (GEOSPrepare) один раз на поток:
+// индексы ее ребер строятся единожды, проверка кандидата идет через
+// GEOSPreparedIntersects, и полное пересечение считается только для
+// реальных попаданий. Кандидат, целиком лежащий внутри опорной области,
+// сам является пересечением. Подготовленная геометрия лениво достраивает
+// индексы и не делится между потоками. Пары прямоугольников считаются без GEOS.
+int runReferenceMode(const vector<string>& inputs, const ProcessorOptions& options, const JobSettings& job) {
+    progress() << "Режим один ко многим: опорный " << inputs[0] << ", кандидатов " << inputs.size() - 1 << '\n';
+    
+    vector<Footprint> footprints = loadFootprints(inputs, options, job.jobs, job.cache);
+    if (!alignFootprintCRS(footprints, job.targetCrs)) {
+        return 1;
+    }
+    const Footprint& reference = footprints[0];
+    if (!reference.valid()) {
+        cerr << "Нет валидной области опорного растра: " << inputs[0] << endl;
+        return 1;
+    }
+    
+    // Охват опорной области, который GEOS кэширует лениво, вычисляется
+    // до запуска потоков, дальше они ее только читают
+    double referenceMinX = 0.0;
+    GEOSGeom_getXMin_r(geosContext(), reference.geometry.get(), &referenceMinX);
+    
+    vector<FeatureField> fields = overlapSchema();
+    unique_ptr<FeatureWriter> writer = openFeatureWriter(job.outputPath, footprints, fields);
+    if (!writer) {
+        return 1;
+    }
+    
+    TileScheduler scheduler(job.jobs);
+    vector<GeosPreparedPtr> prepared(scheduler.size());
+    vector<Overlap> overlaps;
+    vector<char> found;
+    size_t written = 0;
+    atomic<size_t> hits(0);
+    
+    size_t candidates = inputs.size() - 1;
+    for (size_t start = 0; start < candidates; start += overlapChunkSize) {
+        int count = (int)min(candidates - start, (size_t)overlapChunkSize);
+        overlaps.clear();
+        overlaps.resize(count);
+        found.assign(count, 0);
+        scheduler.run(count, [&](int tile, int worker) {
+            StageTimer timer(Stage::Intersection);
+            const Footprint& candidate = footprints[start + tile + 1];
+            if (!candidate.valid()) {
+                return;
+            }
+            Overlap& overlap = overlaps[tile];
+            if (reference.rectangle && candidate.rectangle) {
+                if (intersectFootprints(reference, candidate, overlap)) {
+                    hits++;
+                    found[tile] = 1;
+                }
+                return;
+            }
+            
+            GEOSContextHandle_t local = geosContext();
+            if (!prepared[worker]) {
+                prepared[worker].reset(GEOSPrepare_r(local, reference.geometry.get()));
+            }
+            if (GEOSPreparedIntersects_r(local, prepared[worker].get(), candidate.geometry.get()) != 1) {
+                return;
+            }
+            hits++;
+            
+            if (GEOSPreparedContainsProperly_r(local, prepared[worker].get(), candidate.geometry.get()) == 1) {
+                GEOSArea_r(local, candidate.geometry.get(), &overlap.area);
+                overlap.geometry = candidate.geometry.get();
+                found[tile] = 1;
+                return;
+            }
+            found[tile] = intersectFootprints(reference, candidate, overlap);
+        });
+        
+        for (int i = 0; i < count; ++i) {
+            size_t index = start + i + 1;
+            if (found[i] && !writeOverlap(*writer, fields, inputs[0], inputs[index], overlaps[i])) {
+                cerr << "Ошибка записи: " << job.outputPath << endl;
+                return 1;
+            }
+            written += found[i];
+        }
+    }
+    if (!writer->close()) {
+        cerr << "Ошибка записи: " << job.outputPath << endl;
+        return 1;
+    }
+    
+    progress() << "Попаданий: " << hits << ", пересечений: " << written << '\n';
+    progress() << "Файл " << job.outputPath << " создан!" << '\n';
+    return 0;
+}
+#else
+int runReferenceMode(const vector<string>&, const ProcessorOptions&, const JobSettings&) {
+    cout << "GEOS не доступен" << endl;
+    return 1;
+}
+#endif
+
+// Пустой результат в выбранном по расширению формате
+static void writeEmptyCollection(const string& outputPath, const string& crsWkt = string()) {
+    vector<FeatureField> schema(1);
+    schema[0].name = "name";
+    unique_ptr<FeatureWriter> writer = createFeatureWriter(outputPath);
+    if (writer->open(outputPath, crsWkt, schema)) {
+        writer->close();
+    }
+}
+
+// Пересечение пары в файл результата; nullptr - пересечения нет
+static int writePairResult(const Overlap* overlap, const string& crs, const JobSettings& job) {
+    if (!overlap) {
+        progress() << "Пересечение не найдено или пустое" << '\n';
+        writeEmptyCollection(job.outputPath, crs);
+        return 0;
+    }
+    progress() << "Пересечение найдено!" << '\n';
+    
+    vector<FeatureField> fields(1);
+    fields[0].name = "name";
+    fields[0].text = "Intersection Area";
+    unique_ptr<FeatureWriter> writer = createFeatureWriter(job.outputPath);
+    if (!writer->open(job.outputPath, crs, fields) ||
+        !writer->write(fields, overlap->feature()) || !writer->close()) {
+        cerr << "Ошибка записи: " << job.outputPath << endl;
+        return 1;
+    }
+    
+    progress() << "Файл " << job.outputPath << " создан!" << '\n';
+    return 0;
+}
+
+// Пересечение двух валидных областей в файл результата; области сначала
+// приводятся к общей системе координат
+static int writePairIntersection(vector<Footprint>& footprints, const JobSettings& job) {
+    if (!alignFootprintCRS(footprints, job.targetCrs)) {
+        return 1;
+    }
+    if (!footprints[0].valid() || !footprints[1].valid()) {
+        cerr << "Области не приведены к общей системе координат" << endl;
+        return 1;
+    }
+    
+    // Вычисляем пересечение
+    Overlap overlap;
+    bool found = intersectFootprints(footprints[0], footprints[1], overlap);
+    return writePairResult(found ? &overlap : nullptr, footprints[0].crs, job);
+}
+
+// Совпадение двух CRS, заданных WKT; незаданная совпадает только с незаданной
+static bool sameSpatialRef(const string& wktA, const string& wktB) {
+    if (wktA.empty() || wktB.empty()) {
+        return wktA.empty() && wktB.empty();
+    }
+    OGRSpatialReference a, b;
+    return a.importFromWkt(wktA.c_str()) == OGRERR_NONE && b.importFromWkt(wktB.c_str()) == OGRERR_NONE &&
+           a.IsSame(&b);
+}
+
+// ---------------------------------------------------------------------------
+// Растры на общей сетке: одна CRS и геотрансформации, отличающиеся целым
+// сдвигом (растры одной производственной линии). Пересечение таких растров
+// считается в целых пикселях сетки первого, без перевода координат туда и
+// обратно и без GEOS, а окна чтения их масок совпадают пиксель в пиксель.
+// ---------------------------------------------------------------------------
+struct GridAlignment {
+    int dx = 0, dy = 0;     // пиксель (0, 0) второго растра - пиксель (dx, dy) первого
+    
+    // Окно сетки первого растра - в пиксели второго
+    PixelWindow toOther(const PixelWindow& window) const {
+        PixelWindow result = window;
+        result.xOff -= dx;
+        result.yOff -= dy;
+        return result;
+    }
+};
+
+static bool alignGrids(const RasterProcessor& grid, const RasterProcessor& other, GridAlignment& alignment) {
+    return sameSpatialRef(grid.getSpatialRefWkt(), other.getSpatialRefWkt()) &&
+           grid.gridOffsetTo(other, alignment.dx, alignment.dy);
+}
+
+// Окно [x0, x1) x [y0, y1); пустое, если прямоугольник вырожден
+static PixelWindow pixelRect(int x0, int y0, int x1, int y1) {
+    PixelWindow window;
+    if (x1 > x0 && y1 > y0) {
+        window.xOff = x0;
+        window.yOff = y0;
+        window.xSize = x1 - x0;
+        window.ySize = y1 - y0;
+    }
+    return window;
+}
+
+// Общая часть растров целиком, в пикселях первого
+static PixelWindow alignedRasterOverlap(const RasterProcessor& grid, const RasterProcessor& other,
+                                        const GridAlignment& alignment) {
+    return pixelRect(max(0, alignment.dx), max(0, alignment.dy),
+                     min(grid.getWidth(), other.getWidth() + alignment.dx),
+                     min(grid.getHeight(), other.getHeight() + alignment.dy));
+}
+
+// Пересечение прямоугольников непрозрачных данных, в пикселях первого
+static PixelWindow alignedDataOverlap(const RasterProcessor& grid, const RasterProcessor& other,
+                                      const GridAlignment& alignment) {
+    const MaskStats& a = grid.getMaskStats();
+    const MaskStats& b = other.getMaskStats();
+    if (!a.foundData || !b.foundData) {
+        return PixelWindow();
+    }
+    return pixelRect(max(a.minX, b.minX + alignment.dx), max(a.minY, b.minY + alignment.dy),
+                     min(a.maxX, b.maxX + alignment.dx) + 1, min(a.maxY, b.maxY + alignment.dy) + 1);
+}
+
+// ---------------------------------------------------------------------------
+// Попиксельная маска пересечения: пиксели, непрозрачные в обоих растрах, на
+// сетке первого. Окно - пересечение охватов данных, за его пределами маски
+// не читаются. Если сетки различаются, второй растр берется ближайшим
+// соседом по центрам пикселей первого; у сеток без поворота отображение
+// столбцов и строк независимо, поэтому на полосу строк нужно одно окно
+// второго растра. Полосы высотой в тайл пишутся во временный тайловый
+// 1-битный GeoTIFF со сжатием, который затем копируется в COG - в памяти
+// одновременно только одна полоса.
+// ---------------------------------------------------------------------------
+static bool writeIntersectionMask(RasterProcessor& grid, RasterProcessor& other, const string& outputPath) {
+    StageTimer timer(Stage::Serialize);
+    const int tileSize = 512;
+    
+    double t[6], u[6];
+    if (!grid.getAxisAlignedTransform(t) || !other.getAxisAlignedTransform(u)) {
+        cerr << "Маска пересечения: нужны привязанные растры без поворота" << endl;
+        return false;
+    }
+    if (!sameSpatialRef(grid.getSpatialRefWkt(), other.getSpatialRefWkt())) {
+        cerr << "Маска пересечения: растры в разных системах координат" << endl;
+        return false;
+    }
+    
+    GridAlignment alignment;
+    bool aligned = alignGrids(grid, other, alignment);
+    PixelWindow window;
+    if (aligned) {
+        // Общая сетка: окно - пересечение прямоугольников данных в целых пикселях
+        window = alignedDataOverlap(grid, other, alignment);
+    } else {
+        GeoBox overlap = grid.getDataBox().intersection(other.getDataBox());
+        if (grid.getMaskStats().foundData && other.getMaskStats().foundData && !overlap.empty()) {
+            // Окно пересечения в пикселях первого растра; допуск гасит ошибку
+            // округления на совпадающих границах пикселей
+            const double eps = 1e-9;
+            double px0 = (overlap.minX - t[0]) / t[1], px1 = (overlap.maxX - t[0]) / t[1];
+            double py0 = (overlap.maxY - t[3]) / t[5], py1 = (overlap.minY - t[3]) / t[5];
+            window = pixelRect(max(0, (int)floor(min(px0, px1) + eps)), max(0, (int)floor(min(py0, py1) + eps)),
+                               min(grid.getWidth(), (int)ceil(max(px0, px1) - eps)),
+                               min(grid.getHeight(), (int)ceil(max(py0, py1) - eps)));
+        }
+    }
+    if (window.empty()) {
+        progress() << "Маска пересечения пуста, файл не создан" << '\n';
+        return true;
+    }
+    int x0 = window.xOff, y0 = window.yOff;
+    
+    // Столбцы и строки второго растра для пикселей окна (-1 - вне растра):
+    // на общей сетке - целым сдвигом, иначе - по центрам пикселей
+    vector<int> sourceCol(window.xSize), sourceRow(window.ySize);
+    int colMin = other.getWidth(), colMax = -1;
+    for (int c = 0; c < window.xSize; ++c) {
+        int col = aligned ? x0 + c - alignment.dx
+                          : (int)floor((t[0] + (x0 + c + 0.5) * t[1] - u[0]) / u[1]);
+        sourceCol[c] = (col >= 0 && col < other.getWidth()) ? col : -1;
+        if (sourceCol[c] >= 0) {
+            colMin = min(colMin, col);
+            colMax = max(colMax, col);
+        }
+    }
+    for (int r = 0; r < window.ySize; ++r) {
+        int row = aligned ? y0 + r - alignment.dy
+                          : (int)floor((t[3] + (y0 + r + 0.5) * t[5] - u[3]) / u[5]);
+        sourceRow[r] = (row >= 0 && row < other.getHeight()) ? row : -1;
+    }
+    
+    GDALDriver* gtiff = GetGDALDriverManager()->GetDriverByName("GTiff");
+    if (!gtiff) {
+        cerr << "Драйвер GTiff недоступен" << endl;
+        return false;
+    }
+    string tempPath = outputPath + ".tmp.tif";
+    string blockSize = to_string(tileSize);
+    char** createOptions = nullptr;
+    createOptions = CSLSetNameValue(createOptions, "TILED", "YES");
+    createOptions = CSLSetNameValue(createOptions, "BLOCKXSIZE", blockSize.c_str());
+    createOptions = CSLSetNameValue(createOptions, "BLOCKYSIZE", blockSize.c_str());
+    createOptions = CSLSetNameValue(createOptions, "NBITS", "1");
+    createOptions = CSLSetNameValue(createOptions, "COMPRESS", "DEFLATE");
+    GDALDataset* temp = gtiff->Create(tempPath.c_str(), window.xSize, window.ySize, 1, GDT_Byte, createOptions);
+    CSLDestroy(createOptions);
+    if (!temp) {
+        cerr << "Не удалось создать файл: " << tempPath << endl;
+        return false;
+    }
+    
+    double outTransform[6] = {t[0] + x0 * t[1], t[1], 0.0, t[3] + y0 * t[5], 0.0, t[5]};
+    temp->SetGeoTransform(outTransform);
+    if (!grid.getSpatialRefWkt().empty()) {
+        temp->SetProjection(grid.getSpatialRefWkt().c_str());
+    }
+    GDALRasterBand* outBand = temp->GetRasterBand(1);
+    
+    vector<uint8_t> gridMask, otherMask, strip;
+    long long overlapPixels = 0;
+    bool ok = true;
+    for (int r0 = 0; r0 < window.ySize && ok; r0 += tileSize) {
+        int rows = min(tileSize, window.ySize - r0);
+        strip.assign((size_t)window.xSize * rows, 0);
+        
+        // Строки второго растра, нужные полосе
+        int rowMin = other.getHeight(), rowMax = -1;
+        for (int r = r0; r < r0 + rows; ++r) {
+            if (sourceRow[r] >= 0) {
+                rowMin = min(rowMin, sourceRow[r]);
+                rowMax = max(rowMax, sourceRow[r]);
+            }
+        }
+        
+        if (rowMax >= 0 && colMax >= 0) {
+            PixelWindow gridStrip;
+            gridStrip.xOff = x0;
+            gridStrip.yOff = y0 + r0;
+            gridStrip.xSize = window.xSize;
+            gridStrip.ySize = rows;
+            PixelWindow otherStrip;
+            otherStrip.xOff = colMin;
+            otherStrip.yOff = rowMin;
+            otherStrip.xSize = colMax - colMin + 1;
+            otherStrip.ySize = rowMax - rowMin + 1;
+            ok = grid.readMaskWindow(gridStrip, gridMask) && other.readMaskWindow(otherStrip, otherMask);
+            
+            for (int r = 0; ok && r < rows; ++r) {
+                int sourceY = sourceRow[r0 + r];
+                if (sourceY < 0) continue;
+                const uint8_t* gridLine = &gridMask[(size_t)r * window.xSize];
+                const uint8_t* otherLine = &otherMask[(size_t)(sourceY - rowMin) * otherStrip.xSize];
+                uint8_t* outLine = &strip[(size_t)r * window.xSize];
+                for (int c = 0; c < window.xSize; ++c) {
+                    int sourceX = sourceCol[c];
+                    if (sourceX >= 0 && gridLine[c] == 255 && otherLine[sourceX - colMin] == 255) {
+                        outLine[c] = 1;
+                        overlapPixels++;
+                    }
+                }
+            }
+        }
+        
+        ok = ok && outBand->RasterIO(GF_Write, 0, r0, window.xSize, rows, strip.data(),
+                                     window.xSize, rows, GDT_Byte, 0, 0) == CE_None;
+    }
+    
+    error_code ec;
+    GDALDriver* cog = GetGDALDriverManager()->GetDriverByName("COG");
+    if (ok && cog) {
+        // Обзоры маски строятся ближайшим соседом, чтобы значения оставались 0/1
+        char** cogOptions = nullptr;
+        cogOptions = CSLSetNameValue(cogOptions, "COMPRESS", "DEFLATE");
+        cogOptions = CSLSetNameValue(cogOptions, "BLOCKSIZE", blockSize.c_str());
+        cogOptions = CSLSetNameValue(cogOptions, "NBITS", "1");
+        cogOptions = CSLSetNameValue(cogOptions, "RESAMPLING", "NEAREST");
+        GDALDataset* result = cog->CreateCopy(outputPath.c_str(), temp, FALSE, cogOptions, nullptr, nullptr);
+        CSLDestroy(cogOptions);
+        ok = result != nullptr;
+        if (result) GDALClose(result);
+        GDALClose(temp);
+        filesystem::remove(tempPath, ec);
+    } else {
+        GDALClose(temp);
+        if (ok) {
+            // Без драйвера COG (GDAL < 3.1) остается тайловый GeoTIFF без обзоров
+            progress() << "Драйвер COG недоступен, записан тайловый GeoTIFF" << '\n';
+            filesystem::rename(tempPath, outputPath, ec);
+            ok = !ec;
+        } else {
+            filesystem::remove(tempPath, ec);
+        }
+    }
+    
+    if (!ok) {
+        cerr << "Ошибка записи маски пересечения: " << outputPath << endl;
+        return false;
+    }
+    progress() << "Маска пересечения: " << overlapPixels << " пикселей в окне "
+               << window.xSize << "x" << window.ySize << '\n';
+    progress() << "Файл " << outputPath << " создан!" << '\n';
+    return true;
+}
+
+// Итог пары загруженных растров: пересечение областей в файл результата
+// и, если задана, попиксельная маска. Прямоугольные области растров на
+// общей сетке пересекаются точно, в целых пикселях.
+static int writeProcessorPair(RasterProcessor& processor1, RasterProcessor& processor2,
+                              vector<Footprint>& footprints, const JobSettings& job) {
+    GridAlignment alignment;
+    int result;
+    if (job.targetCrs.empty() && footprints[0].rectangle && footprints[1].rectangle &&
+        alignGrids(processor1, processor2, alignment)) {
+        progress() << "Растры на общей сетке (сдвиг " << alignment.dx << ", " << alignment.dy
+                   << " пикселей), пересечение в целых пикселях" << '\n';
+        PixelWindow window = alignedDataOverlap(processor1, processor2, alignment);
+        Overlap overlap;
+        if (!window.empty()) {
+            overlap.rectangle = true;
+            overlap.box = processor1.pixelRectBox(window.xOff, window.yOff, window.xEnd(), window.yEnd());
+            overlap.area = (double)((int64_t)window.xSize * window.ySize) * processor1.pixelArea();
+        }
+        result = writePairResult(window.empty() ? nullptr : &overlap, footprints[0].crs, job);
+    } else {
+        result = writePairIntersection(footprints, job);
+    }
+    
+    if (result == 0 && !job.maskOutputPath.empty() &&
+        !writeIntersectionMask(processor1, processor2, job.maskOutputPath)) {
+        result = 1;
+    }
+    return result;
+}
+
+// CRS результата пары в WKT, как у writePairResult: заданная --crs или,
+// если она пуста или не разбирается, CRS первого растра
+static string pairResultCrs(const string& targetDefinition, const string& firstWkt) {
+    if (targetDefinition.empty()) {
+        return firstWkt;
+    }
+    OGRSpatialReference target;
+    if (target.SetFromUserInput(targetDefinition.c_str()) != OGRERR_NONE) {
+        return firstWkt;
+    }
+    char* wkt = nullptr;
+    target.exportToWkt(&wkt);
+    string result = wkt ? wkt : firstWkt;
+    CPLFree(wkt);
+    return result;
+}
+
+// Двухфазный режим пары. Фаза 1 сравнивает охваты растров по
+// геотрансформациям без чтения пикселей: непересекающаяся пара стоит ноль
+// операций ввода-вывода. Фаза 2 уточняет границы непрозрачных данных
+// поиском от краев внутрь только в окне общего охвата, так что при
+// частичном перекрытии читаются лишь блоки маски внутри него. Границы
+// окна не равны полной валидной области растра, поэтому в кэш не пишутся.
+int runWindowedPairMode(const vector<string>& inputs, const ProcessorOptions& options, const JobSettings& job) {
+    RasterProcessor processor1(options), processor2(options);
+    if (!processor1.openRaster(inputs[0]) || !processor2.openRaster(inputs[1])) {
+        return 1;
+    }
+    
+    // Фаза 1: охваты в общей CRS; для разных CRS окно не ограничивается.
+    // На общей сетке окна считаются в целых пикселях.
+    GeoBox shared;
+    GridAlignment alignment;
+    bool aligned = alignGrids(processor1, processor2, alignment);
+    PixelWindow alignedWindow = aligned ? alignedRasterOverlap(processor1, processor2, alignment) : PixelWindow();
+    bool sameCrs = sameSpatialRef(processor1.getSpatialRefWkt(), processor2.getSpatialRefWkt());
+    if (sameCrs) {
+        shared = processor1.getRasterBox().intersection(processor2.getRasterBox());
+        if (aligned ? alignedWindow.empty() : shared.empty()) {
+            progress() << "Охваты растров не пересекаются, чтение пикселей не требуется" << '\n';
+            writeEmptyCollection(job.outputPath, pairResultCrs(job.targetCrs, processor1.getSpatialRefWkt()));
+            return 0;
+        }
+    } else {
+        progress() << "Растры в разных системах координат, маски читаются целиком" << '\n';
+    }
+    
+    // Фаза 2: маски только в окне общего охвата
+    RasterProcessor* processors[2] = {&processor1, &processor2};
+    for (int i = 0; i < 2; ++i) {
+        RasterProcessor& processor = *processors[i];
+        PixelWindow window;
+        if (aligned) {
+            window = i == 0 ? alignedWindow : alignment.toOther(alignedWindow);
+        } else if (sameCrs) {
+            window = processor.geoBoxToWindow(shared);
+        } else {
+            window.xSize = processor.getWidth();
+            window.ySize = processor.getHeight();
+        }
+        if (!processor.loadMaskWindow(window)) {
+            cerr << "Ошибка загрузки " << inputs[i] << endl;
+            return 1;
+        }
+    }
+    
+    progress() << "\nВычисление пересечения..." << '\n';
+    
+    vector<Footprint> footprints(2);
+    footprints[0] = makeFootprint(processor1, inputs[0]);
+    footprints[1] = makeFootprint(processor2, inputs[1]);
+    if (!footprints[0].valid() || !footprints[1].valid()) {
+        progress() << "В общем окне нет непрозрачных данных" << '\n';
+        writeEmptyCollection(job.outputPath, pairResultCrs(job.targetCrs, processor1.getSpatialRefWkt()));
+        return 0;
+    }
+    
+    return writeProcessorPair(processor1, processor2, footprints, job);
+}
+
+int runPairMode(const vector<string>& inputs, const ProcessorOptions& options, const JobSettings& job) {
+    // Если оба растра не менялись, области берутся из кэша без загрузки
+    const FootprintCacheEntry* cached1 = job.cache ? job.cache->find(inputs[0]) : nullptr;
+    const FootprintCacheEntry* cached2 = job.cache ? job.cache->find(inputs[1]) : nullptr;
+    if (cached1 && cached2 && job.maskOutputPath.empty()) {
+        vector<Footprint> footprints(2);
+        if (cacheEntryToFootprint(*cached1, inputs[0], footprints[0]) &&
+            cacheEntryToFootprint(*cached2, inputs[1], footprints[1])) {
+            progress() << "Оба растра найдены в кэше, загрузка не требуется" << '\n';
+            return writePairIntersection(footprints, job);
+        }
+    }
+    
+    // Оба изображения загружаются и сканируются конвейером (параллельно при jobs > 1),
+    // сообщения каждого печатаются одним блоком в порядке входов
+    LoadedRaster loaded[2];
+    {
+        LoadPipeline pipeline(inputs, options, job.jobs, true, Verbosity::Normal);
+        LoadedRaster next;
+        while (pipeline.next(next)) {
+            size_t index = next.index;
+            loaded[index] = move(next);
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        progress() << loaded[i].log;
+        if (!loaded[i].ok) {
+            cerr << "Ошибка загрузки " << inputs[i] << endl;
+            return 1;
+        }
+    }
+    RasterProcessor& processor1 = *loaded[0].processor;
+    RasterProcessor& processor2 = *loaded[1].processor;
+    
+    // Выровненные битовые маски пересекаются побитовым AND без геометрии;
+    // результат только печатается, поэтому без вывода не считается
+    if (logEnabled(Verbosity::Normal) && options.storage == MaskStorage::Bits &&
+        processor1.sharesGridWith(processor2) &&
+        processor1.getBitMask().sameShape(processor2.getBitMask())) {
+        progress() << "\nПиксельное пересечение масок: "
+                   << processor1.getBitMask().countAnd(processor2.getBitMask()) << " пикселей" << '\n';
+    }
+    
+    progress() << "\nВычисление пересечения..." << '\n';
+    
+    vector<Footprint> footprints(2);
+    footprints[0] = makeFootprint(processor1, inputs[0]);
+    footprints[1] = makeFootprint(processor2, inputs[1]);
+    
+    if (footprints[0].valid() && footprints[1].valid()) {
+        if (footprints[0].rectangle && footprints[1].rectangle) {
+            progress() << "Обе области прямоугольные, пересечение без GEOS" << '\n';
+        } else {
+            progress() << "Геометрии созданы успешно" << '\n';
+        }
+        if (job.cache) {
+            FootprintCacheEntry entry1 = makeCacheEntry(footprints[0], processor1.getMaskStats());
+            FootprintCacheEntry entry2 = makeCacheEntry(footprints[1], processor2.getMaskStats());
+            entry1.setRasterBox(processor1.getRasterBox());
+            entry2.setRasterBox(processor2.getRasterBox());
+            job.cache->store(inputs[0], move(entry1));
+            job.cache->store(inputs[1], move(entry2));
+        }
+        return writeProcessorPair(processor1, processor2, footprints, job);
+    }
+    
+    cerr << "Не удалось создать геометрии" << endl;
+    if (!footprints[0].valid()) cerr << "  - Геометрия 1 не создана" << endl;
+    if (!footprints[1].valid()) cerr << "  - Геометрия 2 не создана" << endl;
+    #ifndef HAS_GEOS
+    cout << "GEOS не доступен: непрямоугольные и повернутые области не поддерживаются" << endl;
+    #endif
+    
+    return 0;
+}
+
+bool writeMetrics(const string& path) {
+    ofstream out(path, ios::trunc);
+    if (!out) {
+        cerr << "Не удалось записать метрики: " << path << endl;
+        return false;
+    }
+    string ext = filesystem::path(path).extension().string();
+    if (ext == ".prom") {
+        Metrics::global().writePrometheus(out);
+    } else {
+        Metrics::global().writeJsonLines(out);
+    }
+    return (bool)out;
+}
+
+shared_ptr<FootprintCache> openFootprintCache(const string& cachePath, const ProcessorOptions& options) {
+    shared_ptr<FootprintCache> cache = make_shared<FootprintCache>(cachePath, options);
+    cache->load();
+    return cache;
+}
+
+bool saveFootprintCache(FootprintCache& cache) {
+    return cache.save();
+}
+
+// ---------------------------------------------------------------------------
+// Встраиваемый API (raster_overlap.h). Внутренний Footprint переводится в
+// RasterFootprint и обратно тем же путем, что и записи кэша.
+// ---------------------------------------------------------------------------
+static RasterFootprint toRasterFootprint(const Footprint& footprint, const MaskStats& stats) {
+    FootprintCacheEntry entry = makeCacheEntry(footprint, stats);
+    RasterFootprint result;
+    result.name = footprint.path;
+    result.minX = entry.minX;
+    result.minY = entry.minY;
+    result.maxX = entry.maxX;
+    result.maxY = entry.maxY;
+    result.rectangle = entry.rectangle;
+    result.wkb = move(entry.wkb);
+    result.crs = move(entry.crs);
+    result.opaqueCount = entry.opaqueCount;
+    return result;
+}
+
+static bool fromRasterFootprint(const RasterFootprint& footprint, Footprint& result) {
+    FootprintCacheEntry entry;
+    entry.minX = footprint.minX;
+    entry.minY = footprint.minY;
+    entry.maxX = footprint.maxX;
+    entry.maxY = footprint.maxY;
+    entry.rectangle = footprint.rectangle;
+    entry.wkb = footprint.wkb;
+    entry.crs = footprint.crs;
+    return cacheEntryToFootprint(entry, footprint.name, result);
+}
+
+// Область по загруженной маске процессора
+static bool buildFootprint(RasterProcessor& processor, const string& name, RasterFootprint& footprint) {
+    Footprint built = makeFootprint(processor, name);
+    if (!built.valid()) {
+        return false;
+    }
+    footprint = toRasterFootprint(built, processor.getMaskStats());
+    return true;
+}
+
+bool computeFootprint(GDALDataset* dataset, const ProcessorOptions& options, RasterFootprint& footprint) {
+    RasterProcessor processor(options);
+    processor.silenceLog();
+    string name = dataset && dataset->GetDescription() ? dataset->GetDescription() : "";
+    return processor.loadDataset(dataset, name) && buildFootprint(processor, name, footprint);
+}
+
+bool computeFootprint(const string& path, const ProcessorOptions& options, RasterFootprint& footprint) {
+    RasterProcessor processor(options);
+    processor.silenceLog();
+    return processor.loadRaster(path) && buildFootprint(processor, path, footprint);
+}
+
+bool computeFootprintFromBuffer(const void* data, size_t size, const ProcessorOptions& options,
+                                RasterFootprint& footprint) {
+    static atomic<unsigned> counter(0);
+    ostringstream name;
+    name << "/vsimem/raster_overlap_" << counter++ << "_" << data;
+    string path = name.str();
+    
+    // Буфер не копируется и не освобождается при VSIUnlink
+    VSILFILE* file = VSIFileFromMemBuffer(path.c_str(), (GByte*)data, (vsi_l_offset)size, FALSE);
+    if (!file) {
+        cerr << "Не удалось разместить буфер в /vsimem/" << endl;
+        return false;
+    }
+    VSIFCloseL(file);
+    
+    bool ok = computeFootprint(path, options, footprint);
+    VSIUnlink(path.c_str());
+    return ok;
+}
+
+// Маска оборачивается в набор MEM: единственный канал с интерпретацией
+// альфа-канала, так что дальше работает обычный путь анализа. Ядра сканирования
+// считают валидным только 255, поэтому маска с другими ненулевыми значениями
+// (например, 0/1) сначала приводится к 0/255 в копии; маска 0/255 не копируется.
+bool computeMaskFootprint(const uint8_t* mask, int width, int height, size_t lineStride,
+                          const double geoTransform[6], const string& crsWkt,
+                          const ProcessorOptions& options, RasterFootprint& footprint) {
+    registerDrivers();
+    GDALDriver* memDriver = GetGDALDriverManager()->GetDriverByName("MEM");
+    if (lineStride == 0) {
+        lineStride = (size_t)width;
+    }
+    if (!memDriver || !mask || width <= 0 || height <= 0 || lineStride < (size_t)width) {
+        return false;
+    }
+    
+    bool binary = true;
+    for (int y = 0; y < height && binary; ++y) {
+        const uint8_t* line = mask + y * lineStride;
+        binary = all_of(line, line + width, [](uint8_t value) { return value == 0 || value == 255; });
+    }
+    vector<uint8_t> normalized;
+    if (!binary) {
+        normalized.resize((size_t)width * height);
+        for (int y = 0; y < height; ++y) {
+            const uint8_t* line = mask + y * lineStride;
+            transform(line, line + width, normalized.begin() + (size_t)y * width,
+                      [](uint8_t value) { return value ? (uint8_t)255 : (uint8_t)0; });
+        }
+        mask = normalized.data();
+        lineStride = (size_t)width;
+    }
+    GDALDataset* dataset = memDriver->Create("", width, height, 0, GDT_Byte, nullptr);
+    if (!dataset) {
+        return false;
+    }
+    
+    char pointer[64];
+    snprintf(pointer, sizeof(pointer), "%p", (const void*)mask);
+    char stride[32];
+    snprintf(stride, sizeof(stride), "%llu", (unsigned long long)lineStride);
+    char** bandOptions = nullptr;
+    bandOptions = CSLSetNameValue(bandOptions, "DATAPOINTER", pointer);
+    bandOptions = CSLSetNameValue(bandOptions, "PIXELOFFSET", "1");
+    bandOptions = CSLSetNameValue(bandOptions, "LINEOFFSET", stride);
+    CPLErr err = dataset->AddBand(GDT_Byte, bandOptions);
+    CSLDestroy(bandOptions);
+    
+    bool ok = false;
+    if (err == CE_None) {
+        double transform[6];
+        copy(geoTransform, geoTransform + 6, transform);
+        dataset->SetGeoTransform(transform);
+        if (!crsWkt.empty()) {
+            dataset->SetProjection(crsWkt.c_str());
+        }
+        dataset->GetRasterBand(1)->SetColorInterpretation(GCI_AlphaBand);
+        ok = computeFootprint(dataset, options, footprint);
+    }
+    GDALClose(dataset);
+    return ok;
+}
+
+bool intersectRasterFootprints(const RasterFootprint& a, const RasterFootprint& b, RasterOverlap& overlap) {
+    overlap = RasterOverlap();
+    vector<Footprint> footprints(2);
+    if (!fromRasterFootprint(a, footprints[0]) || !fromRasterFootprint(b, footprints[1])) {
+        cerr << "Недопустимая валидная область" << endl;
+        return false;
+    }
+    if (!alignFootprintCRS(footprints, a.crs) || !footprints[1].valid()) {
+        return false;
+    }
+    overlap.a = a.name;
+    overlap.b = b.name;
+    overlap.crs = a.crs;
+    
+    Overlap result;
+    if (!intersectFootprints(footprints[0], footprints[1], result)) {
+        return true;
+    }
+    overlap.found = true;
+    overlap.area = result.area;
+    overlap.rectangle = result.rectangle;
+    if (result.rectangle) {
+        overlap.minX = result.box.minX;
+        overlap.minY = result.box.minY;
+        overlap.maxX = result.box.maxX;
+        overlap.maxY = result.box.maxY;
+        return true;
+    }
+    
+    #ifdef HAS_GEOS
+    GeoBox box = geometryBox(result.geometry);
+    overlap.minX = box.minX;
+    overlap.minY = box.minY;
+    overlap.maxX = box.maxX;
+    overlap.maxY = box.maxY;
+    
+    GEOSContextHandle_t ctx = geosContext();
+    size_t size = 0;
+    unsigned char* wkb = GEOSGeomToWKB_buf_r(ctx, result.geometry, &size);
+    if (wkb) {
+        overlap.wkb.assign(reinterpret_cast<const char*>(wkb), size);
+        GEOSFree_r(ctx, wkb);
+    }
+    #endif
+    return true;
+}
+
+bool writeRasterOverlaps(const string& outputPath, const vector<RasterOverlap>& overlaps) {
+    string crs;
+    for (const RasterOverlap& overlap : overlaps) {
+        if (overlap.found) {
+            crs = overlap.crs;
+            break;
+        }
+    }
+    vector<FeatureField> fields = overlapSchema();
+    unique_ptr<FeatureWriter> writer = createFeatureWriter(outputPath);
+    if (!writer->open(outputPath, crs, fields)) {
+        return false;
+    }
+    
+    for (const RasterOverlap& overlap : overlaps) {
+        if (!overlap.found) {
+            continue;
+        }
+        fields[0].text = overlap.a;
+        fields[1].text = overlap.b;
+        fields[2].number = overlap.area;
+        
+        FeatureGeometry geometry;
+        GeoBox box{overlap.minX, overlap.minY, overlap.maxX, overlap.maxY};
+        #ifdef HAS_GEOS
+        GeosGeometryPtr parsed;
+        #endif
+        if (overlap.rectangle) {
+            geometry.box = &box;
+        }
+        #ifdef HAS_GEOS
+        else {
+            parsed.reset(GEOSGeomFromWKB_buf_r(geosContext(),
+                                               reinterpret_cast<const unsigned char*>(overlap.wkb.data()),
+                                               overlap.wkb.size()));
+            geometry.geometry = parsed.get();
+        }
+        #endif
+        if (!writer->write(fields, geometry)) {
+            writer->close();
+            return false;
+        }
+    }
+    return writer->close();
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+// Библиотека пересечения валидных областей растров. Исполняемый файл
+// raster_intersection - тонкая обертка над ней; сервисы могут вызывать ее
+// напрямую с уже открытым GDALDataset, буфером в памяти или маской, не
+// запуская процесс и не проходя через файловую систему.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class GDALDataset;
+
+// Способ хранения альфа-канала
+enum class MaskStorage {
+    Dense,      // весь канал читается в maskData (width * height байт)
+    Streaming,  // канал обходится поблочно, в памяти только текущий блок
+    Spans,      // отрезки непрозрачных пикселей по строкам (RLE), строятся при чтении
+    Bits        // 1 бит на пиксель, строки выровнены по 64-битным словам
+};
+
+// Что вычисляется при анализе маски
+enum class MaskScanMode {
+    Statistics, // полный проход: границы, количество и гистограмма по строкам
+    BoundsOnly  // только границы, поиск от краев растра внутрь с ранним выходом
+};
+
+// Форма геометрии валидной области
+enum class FootprintMode {
+    BoundingBox,    // прямоугольник по границам непрозрачных данных
+    Polygon         // реальный контур маски (GDALPolygonize), с дырами
+};
+
+struct ProcessorOptions {
+    MaskStorage storage = MaskStorage::Dense;
+    MaskScanMode scanMode = MaskScanMode::Statistics;
+    bool useOverviews = false;  // грубый поиск границ по обзорам, затем точное уточнение
+    FootprintMode footprint = FootprintMode::BoundingBox;
+    double simplifyTolerance = 0.0; // допуск упрощения контура в единицах СК, 0 - без упрощения
+    int threads = 1;            // потоков анализа маски, 0 - по числу ядер
+    bool mapMask = true;        // Dense: несжатый байтовый канал отображается в память, а не копируется
+};
+
+// Подробность сообщений о ходе обработки; ошибки печатаются всегда
+enum class Verbosity {
+    Quiet,      // только ошибки
+    Normal,     // итоги режимов; для пары - и сведения о растрах
+    Verbose     // плюс сообщения анализа каждого растра в пакетных режимах
+};
+
+// Уровень для всего процесса. Сообщения пишутся в cout без сброса буфера;
+// отключенный уровень не форматирует их вовсе.
+void setVerbosity(Verbosity verbosity);
+
+// Профиль ввода-вывода GDAL для процесса. Задается до первого открытия
+// растра; параметры, уже заданные в окружении, профиль не переопределяет
+// (явные cacheMaxMb и decodeThreads - переопределяют).
+enum class IoPreset {
+    Local,  // настройки GDAL по умолчанию
+    Cloud   // сжатые COG в объектных хранилищах: многопоточная распаковка,
+            // кэш VSI, объединение диапазонных запросов HTTP
+};
+
+struct IoProfile {
+    IoPreset preset = IoPreset::Local;
+    int cacheMaxMb = 0;         // GDAL_CACHEMAX в МБ, 0 - по профилю
+    int decodeThreads = -1;     // GDAL_NUM_THREADS: -1 - по профилю, 0 - все ядра
+};
+
+void applyIoProfile(const IoProfile& profile);
+
+// Облачные адреса как входы: s3://, gs://, az:// и http(s):// переводятся
+// в пути GDAL (/vsis3/, /vsigs/, /vsiaz/, /vsicurl/); остальные - без изменений
+std::string gdalPath(const std::string& path);
+
+// Путь читается по сети (/vsicurl/, /vsis3/ и т.п., в т.ч. внутри /vsizip/)
+bool isRemotePath(const std::string& path);
+
+// ---------------------------------------------------------------------------
+// Встраиваемый API. Результаты не зависят от сборки с GEOS: геометрия
+// передается в WKB, прямоугольная область - одним охватом. Сообщения о
+// ходе обработки не печатаются, ошибки идут в cerr.
+// ---------------------------------------------------------------------------
+
+// Валидная область растра. Координаты - в системе crs (WKT, пустая - не
+// задана); wkb пуст, если область - сам охват (rectangle).
+struct RasterFootprint {
+    std::string name;
+    double minX = 0.0, minY = 0.0, maxX = 0.0, maxY = 0.0;
+    bool rectangle = false;
+    std::string wkb;
+    std::string crs;
+    int64_t opaqueCount = -1;   // непрозрачных пикселей, -1 - не считалось
+    
+    bool valid() const {
+        return rectangle || !wkb.empty();
+    }
+};
+
+// Пересечение двух валидных областей в CRS первой из них
+struct RasterOverlap {
+    std::string a, b;           // имена областей
+    bool found = false;
+    double area = 0.0;
+    double minX = 0.0, minY = 0.0, maxX = 0.0, maxY = 0.0;
+    bool rectangle = false;     // пересечение - сам охват, wkb пуст
+    std::string wkb;
+    std::string crs;
+};
+
+// Уже открытый набор; он не закрывается и не должен использоваться
+// другими потоками, пока идет вызов. Маска читается в одном потоке
+// независимо от options.threads: набор не переоткрывается по имени
+bool computeFootprint(GDALDataset* dataset, const ProcessorOptions& options, RasterFootprint& footprint);
+
+// Любой путь GDAL, включая /vsimem/, /vsicurl/ и т.п.
+bool computeFootprint(const std::string& path, const ProcessorOptions& options, RasterFootprint& footprint);
+
+// Файл растра целиком в памяти (GeoTIFF и т.п.); буфер не копируется
+bool computeFootprintFromBuffer(const void* data, size_t size, const ProcessorOptions& options,
+                                RasterFootprint& footprint);
+
+// Маска валидности: ненулевой байт - валидный пиксель; строки через
+// lineStride байт, 0 - строки подряд (width байт); lineStride < width - false.
+// geoTransform - как у GDAL, crsWkt может быть пустой.
+bool computeMaskFootprint(const uint8_t* mask, int width, int height, size_t lineStride,
+                          const double geoTransform[6], const std::string& crsWkt,
+                          const ProcessorOptions& options, RasterFootprint& footprint);
+
+// Пересечение областей; при разных CRS b переводится в CRS a (нужен GEOS).
+// false - ошибка; пустое пересечение - true и overlap.found == false.
+bool intersectRasterFootprints(const RasterFootprint& a, const RasterFootprint& b, RasterOverlap& overlap);
+
+// Найденные пересечения в файл; формат по расширению, как у --output
+bool writeRasterOverlaps(const std::string& outputPath, const std::vector<RasterOverlap>& overlaps);
+
+// ---------------------------------------------------------------------------
+// Режимы командной строки
+// ---------------------------------------------------------------------------
+
+// Постоянный кэш валидных областей между запусками
+class FootprintCache;
+
+std::shared_ptr<FootprintCache> openFootprintCache(const std::string& cachePath, const ProcessorOptions& options);
+bool saveFootprintCache(FootprintCache& cache);
+
+// Параметры запуска режимов, не относящиеся к анализу отдельного растра
+struct JobSettings {
+    int jobs = 2;                       // входов, загружаемых одновременно
+    FootprintCache* cache = nullptr;
+    std::string targetCrs;              // общая CRS, пустая - первого растра
+    std::string outputPath;
+    std::string maskOutputPath;         // попиксельная маска пересечения (COG)
+    bool windowed = false;              // пара: двухфазное чтение только общего окна
+    int shardIndex = 0;                 // пакетный режим: номер шарда (0..shardCount-1)
+    int shardCount = 1;
+};
+
+// Принудительный выбор ядра сканирования по имени ("auto", "scalar", "sse2", "avx2", "neon")
+bool selectRowScanKernel(const std::string& name);
+const char* activeRowScanKernelName();
+
+// Метрики процесса с начала работы: время стадий (открытие, чтение,
+// анализ маски, геометрия, пересечение, запись), прочитанные байты и
+// блоки, попадания в блочный кэш GDAL, пиковый RSS. Формат по расширению:
+// .prom - текстовый формат Prometheus, иначе JSON lines.
+bool writeMetrics(const std::string& path);
+
+// Сетевые запросы и загруженные байты всех сетевых путей процесса;
+// false - статистика недоступна (GDAL до 3.2)
+bool networkTransfer(uint64_t& requests, uint64_t& bytes);
+
+// Растры каталога или строки файла-списка
+std::vector<std::string> collectInputs(const std::string& source);
+
+int runBatchMode(const std::vector<std::string>& inputs, const ProcessorOptions& options, const JobSettings& job);
+// Обновление результата job.outputPath пакетного режима: пересчитываются
+// только пары растров changed (замененных, добавленных или удаленных)
+int runIncrementalMode(const std::vector<std::string>& inputs, const std::vector<std::string>& changed,
+                       const ProcessorOptions& options, const JobSettings& job);
+// Пары шарда job.shardIndex из job.shardCount; результаты шардов
+// объединяет runMergeMode
+int runShardMode(const std::vector<std::string>& inputs, const ProcessorOptions& options, const JobSettings& job);
+int runMergeMode(const std::vector<std::string>& parts, const JobSettings& job);
+int runReferenceMode(const std::vector<std::string>& inputs, const ProcessorOptions& options, const JobSettings& job);
+int runWindowedPairMode(const std::vector<std::string>& inputs, const ProcessorOptions& options, const JobSettings& job);
+int runPairMode(const std::vector<std::string>& inputs, const ProcessorOptions& options, const JobSettings& job);